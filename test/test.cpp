@@ -39,7 +39,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <random>
 #include <map>
+#include <algorithm>
 #include <cmath>
+#include <sys/wait.h>
 
 // Additional includes for audio file analysis
 extern "C" {
@@ -127,6 +129,41 @@ std::vector<std::string> findFilesWithExtension(const std::string& directory, co
     return files;
 }
 
+// Helper function to check that two output trees hold the same files with
+// the given extensions, byte for byte
+bool compareOutputTrees(const std::string& dir_a, const std::string& dir_b,
+                        const std::vector<std::string>& extensions = {".wav"}) {
+    if (!std::filesystem::is_directory(dir_a) || !std::filesystem::is_directory(dir_b)) {
+        std::cerr << "  Missing output directory: " << dir_a << " or " << dir_b << std::endl;
+        return false;
+    }
+    std::vector<std::string> files_a;
+    size_t count_b = 0;
+    for (const auto& extension : extensions) {
+        std::vector<std::string> found = findFilesWithExtension(dir_a, extension);
+        files_a.insert(files_a.end(), found.begin(), found.end());
+        count_b += findFilesWithExtension(dir_b, extension).size();
+    }
+    std::cout << "  " << files_a.size() << " files in " << dir_a << ", "
+              << count_b << " in " << dir_b << std::endl;
+    if (files_a.empty() || files_a.size() != count_b) {
+        return false;
+    }
+
+    for (const auto& file : files_a) {
+        std::filesystem::path relative = std::filesystem::path(file).lexically_relative(dir_a);
+        std::ifstream a(file, std::ios::binary);
+        std::ifstream b(std::filesystem::path(dir_b) / relative, std::ios::binary);
+        std::string bytes_a((std::istreambuf_iterator<char>(a)), std::istreambuf_iterator<char>());
+        std::string bytes_b((std::istreambuf_iterator<char>(b)), std::istreambuf_iterator<char>());
+        if (!b || bytes_a != bytes_b) {
+            std::cerr << "  Output differs: " << relative.string() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 // Helper function to verify WAV file format
 void verifyWavFormat(const std::string& filepath, int expected_bit_depth = 16) {
     std::string file_type = getFileType(filepath);
@@ -385,163 +422,2070 @@ bool testStemLengthConsistency(const std::string& module_file, const std::string
     }
 }
 
-int main(int argc, char* argv[]) {
-    std::cout << "=== Untracker Integration Test ===" << std::endl;
+// Test function to check that every extracted stem is listed in report.json
+bool testModuleReport(const std::string& output_dir) {
+    std::cout << "\n=== Test: Module Loudness Report ===" << std::endl;
+
+    std::vector<std::string> reports;
+    for (const auto& file : findFilesWithExtension(output_dir, ".json")) {
+        if (std::filesystem::path(file).filename() == "report.json") {
+            reports.push_back(file);
+        }
+    }
+    if (reports.empty()) {
+        std::cerr << "  No report.json found in " << output_dir << std::endl;
+        return false;
+    }
+
+    std::ifstream report_file(reports[0]);
+    std::stringstream contents;
+    contents << report_file.rdbuf();
+    std::string report = contents.str();
+
+    std::vector<std::string> wav_files = findFilesWithExtension(output_dir, ".wav");
+    for (const auto& file : wav_files) {
+        std::string filename = std::filesystem::path(file).filename().string();
+        if (report.find("\"" + filename + "\"") == std::string::npos) {
+            std::cerr << "  Stem missing from report: " << filename << std::endl;
+            return false;
+        }
+    }
+
+    if (!wav_files.empty() && report.find("\"integrated_lufs\"") == std::string::npos) {
+        std::cerr << "  Report has no loudness measurements" << std::endl;
+        return false;
+    }
+
+    std::cout << "  Report lists all " << wav_files.size() << " stems" << std::endl;
+    return true;
+}
+
+// Test function to check that --peaks writes one overview per stem and zoom level
+bool testPeaksFiles(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Waveform Peaks Files ===" << std::endl;
 
-    // Find the executable
     std::string exe_path = findExecutable();
     if (exe_path.empty()) {
-        return 1;
+        return false;
     }
-    std::cout << "✓ untracker executable found at: " << exe_path << std::endl;
 
-    // Check if a test module file was provided
-    if (argc < 2) {
-        std::cerr << "USAGE: " << argv[0] << " <test_module_file>" << std::endl;
-        std::cerr << "Example: " << argv[0] << " test_module.xm" << std::endl;
-        return 1;
-    }
+    std::string output_dir = output_dir_base + "_peaks_test";
+    std::filesystem::create_directories(output_dir);
 
-    // Find the test module file
-    std::string test_module = findModuleFile(argv[1]);
-    if (test_module.empty()) {
-        return 1;
+    std::string cmd = exe_path + " -i \"" + module_file + "\" -o \"" + output_dir + "\" --peaks --peaks-spp 512 --peaks-levels 2";
+    if (!runCommand(cmd, "Extracting stems with waveform peaks")) {
+        std::cerr << "✗ Stem extraction with peaks failed" << std::endl;
+        return false;
     }
-    std::cout << "✓ Test module file found: " << test_module << std::endl;
 
-    // Create a temporary output directory for the test
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(1000, 9999);
-    std::string output_dir = OUTPUT_DIR_PREFIX + std::to_string(dis(gen));
-    std::filesystem::create_directory(output_dir);
+    std::vector<std::string> wav_files = findFilesWithExtension(output_dir, ".wav");
+    std::vector<std::string> dat_files = findFilesWithExtension(output_dir, ".dat");
+    std::cout << "  Found " << wav_files.size() << " stems and " << dat_files.size() << " peaks files" << std::endl;
 
-    std::cout << "✓ Created temporary output directory: " << output_dir << std::endl;
+    if (dat_files.size() != wav_files.size() * 2) {
+        std::cerr << "  Expected two zoom levels per stem" << std::endl;
+        return false;
+    }
 
-    // Test 1: Basic extraction
-    std::string cmd1 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir + "\"";
-    if (runCommand(cmd1, "Test 1: Basic stem extraction")) {
-        std::cout << "✓ Basic extraction completed successfully" << std::endl;
+    // Header: version, flags, sample rate, samples per pixel, length, channels
+    for (const auto& file : dat_files) {
+        std::ifstream in(file, std::ios::binary);
+        int32_t header[6] = {0};
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        bool expected_spp = file.find(".512.dat") != std::string::npos ? header[3] == 512 : header[3] == 1024;
+        if (!in || header[0] != 2 || !expected_spp || header[4] <= 0) {
+            std::cerr << "  Invalid peaks header: " << file << std::endl;
+            return false;
+        }
+        auto expected_size = sizeof(header) + static_cast<size_t>(header[4]) * header[5] * 2 * sizeof(int16_t);
+        if (std::filesystem::file_size(file) != expected_size) {
+            std::cerr << "  Unexpected peaks file size: " << file << std::endl;
+            return false;
+        }
+    }
+    std::filesystem::remove_all(output_dir);
 
-        // Count extracted files in subdirectories
-        std::vector<std::string> wav_files = findFilesWithExtension(output_dir, ".wav");
-        std::cout << "  Extracted " << wav_files.size() << " stem files" << std::endl;
+    // Opus resamples a 22050 Hz render to 48000 Hz, so no output is at the
+    // render rate; the peaks still describe the render, next to the Opus stem
+    std::string cmd_opus = exe_path + " -i \"" + module_file + "\" -o \"" + output_dir +
+                           "\" --format opus --sample-rate 22050 --peaks --peaks-levels 1";
+    if (!runCommand(cmd_opus, "Extracting Opus stems from a 22050 Hz render with peaks")) {
+        std::cerr << "✗ Stem extraction with peaks failed" << std::endl;
+        return false;
+    }
+    std::vector<std::string> opus_files = findFilesWithExtension(output_dir, ".opus");
+    for (const auto& file : opus_files) {
+        std::string dat = file.substr(0, file.size() - 5) + ".256.dat";
+        std::ifstream in(dat, std::ios::binary);
+        int32_t header[6] = {0};
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!in || header[2] != 22050) {
+            std::cerr << "  Missing 22050 Hz peaks next to " << file << std::endl;
+            return false;
+        }
+    }
+    std::cout << "  Found peaks at the render rate next to " << opus_files.size() << " Opus stems" << std::endl;
 
-        // Verify file formats using 'file' utility
-        if (!wav_files.empty()) {
-            verifyWavFormat(wav_files[0], 16); // Default to 16-bit
+    std::filesystem::remove_all(output_dir);
+    return !opus_files.empty();
+}
+
+// STREAMINFO and SEEKTABLE fields of a FLAC file
+struct FlacMetadata {
+    int min_blocksize = 0;
+    bool md5_set = false;
+    bool has_seektable = false;
+    int seekpoints = 0; // not counting placeholders
+};
+
+FlacMetadata readFlacMetadata(const std::string& filepath) {
+    FlacMetadata metadata;
+    std::ifstream in(filepath, std::ios::binary);
+    char magic[4];
+    if (!in.read(magic, 4) || std::string(magic, 4) != "fLaC") {
+        return metadata;
+    }
+    bool last = false;
+    while (!last) {
+        unsigned char header[4];
+        if (!in.read(reinterpret_cast<char*>(header), 4)) {
+            break;
+        }
+        last = header[0] & 0x80;
+        int type = header[0] & 0x7f;
+        size_t length = (size_t(header[1]) << 16) | (size_t(header[2]) << 8) | header[3];
+        std::vector<unsigned char> block(length);
+        if (!in.read(reinterpret_cast<char*>(block.data()), length)) {
+            break;
+        }
+        if (type == 0 && length == 34) {
+            metadata.min_blocksize = (block[0] << 8) | block[1];
+            metadata.md5_set = std::any_of(block.begin() + 18, block.end(),
+                                           [](unsigned char b) { return b != 0; });
+        } else if (type == 3) {
+            metadata.has_seektable = true;
+            for (size_t at = 0; at + 18 <= length; at += 18) {
+                bool placeholder = std::all_of(block.begin() + at, block.begin() + at + 8,
+                                               [](unsigned char b) { return b == 0xff; });
+                metadata.seekpoints += placeholder ? 0 : 1;
+            }
         }
-    } else {
-        std::cerr << "✗ Basic extraction failed" << std::endl;
-        std::filesystem::remove_all(output_dir);
-        return 1;
     }
+    return metadata;
+}
 
-    // Test 2: Extraction with higher sample rate
-    std::string output_dir2 = output_dir + "_48k";
-    std::filesystem::create_directory(output_dir2);
-    std::string cmd2 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir2 + "\" --sample-rate 48000";
-    if (runCommand(cmd2, "Test 2: Extraction with higher sample rate")) {
-        std::cout << "✓ High sample rate extraction completed successfully" << std::endl;
+// Test function to check that --flac-level, --flac-seekpoint-spacing and
+// --no-flac-md5 show in the metadata of the FLAC stems. Built without
+// libFLAC, libsndfile writes the seek table and signature its own way, so
+// only the level is checked.
+bool testFlacOptions(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: FLAC Encoder Options ===" << std::endl;
 
-        // Count extracted files in subdirectories
-        std::vector<std::string> wav_files2 = findFilesWithExtension(output_dir2, ".wav");
-        std::cout << "  Extracted " << wav_files2.size() << " stem files with high sample rate" << std::endl;
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
 
-        // Verify file formats using 'file' utility
-        if (!wav_files2.empty()) {
-            verifyWavFormat(wav_files2[0], 16); // Default to 16-bit
+    std::string fast_dir = output_dir_base + "_flac_fast_test";
+    std::string small_dir = output_dir_base + "_flac_small_test";
+    std::string log_path = output_dir_base + "_flac_options.log";
+    std::string input = " -i \"" + module_file + "\" --format flac";
+    std::string cmd_fast = exe_path + input + " -o \"" + fast_dir +
+                           "\" --flac-level 0 --flac-seekpoint-spacing 0.1 > \"" + log_path + "\"";
+    std::string cmd_small = exe_path + input + " -o \"" + small_dir +
+                            "\" --flac-level 8 --flac-seekpoint-spacing 0 --no-flac-md5";
+    if (!runCommand(cmd_fast, "Encoding FLAC at level 0 with a seek point every 0.1 s") ||
+        !runCommand(cmd_small, "Encoding FLAC at level 8 without seek table or MD5")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+    std::ifstream log(log_path);
+    std::string output((std::istreambuf_iterator<char>(log)), std::istreambuf_iterator<char>());
+    bool native = output.find("libsndfile: seek table and MD5") == std::string::npos;
+
+    std::vector<std::string> fast_files = findFilesWithExtension(fast_dir, ".flac");
+    if (fast_files.empty()) {
+        std::cerr << "  No FLAC stems written" << std::endl;
+        return false;
+    }
+    for (const auto& file : fast_files) {
+        std::filesystem::path relative = std::filesystem::path(file).lexically_relative(fast_dir);
+        FlacMetadata fast = readFlacMetadata(file);
+        FlacMetadata small = readFlacMetadata((std::filesystem::path(small_dir) / relative).string());
+        std::cout << "  " << relative.string() << ": blocks of " << fast.min_blocksize << " and "
+                  << small.min_blocksize << ", " << fast.seekpoints << " seek points, MD5 "
+                  << (fast.md5_set ? "set" : "unset") << " and " << (small.md5_set ? "set" : "unset")
+                  << std::endl;
+        // libFLAC uses 1152-sample blocks up to level 2 and 4096 above
+        if (fast.min_blocksize != 1152 || small.min_blocksize != 4096) {
+            std::cerr << "  --flac-level did not reach the encoder" << std::endl;
+            return false;
         }
-    } else {
-        std::cerr << "✗ High sample rate extraction failed" << std::endl;
-        std::filesystem::remove_all(output_dir2);
+        if (native && (fast.seekpoints < 2 || small.has_seektable)) {
+            std::cerr << "  --flac-seekpoint-spacing was not applied" << std::endl;
+            return false;
+        }
+        if (native && (!fast.md5_set || small.md5_set)) {
+            std::cerr << "  --no-flac-md5 was not applied" << std::endl;
+            return false;
+        }
+    }
+    if (!native) {
+        std::cout << "  Built without libFLAC: seek table and MD5 not checked" << std::endl;
     }
 
-    // Test 3: Extraction with FLAC format
-    std::string output_dir3 = output_dir + "_flac";
-    std::filesystem::create_directory(output_dir3);
-    std::string cmd3 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir3 + "\" --format flac";
-    if (runCommand(cmd3, "Test 3: Extraction with FLAC format")) {
-        std::cout << "✓ FLAC format extraction completed successfully" << std::endl;
+    std::filesystem::remove_all(fast_dir);
+    std::filesystem::remove_all(small_dir);
+    std::filesystem::remove(log_path);
+    return true;
+}
 
-        // Count extracted files in subdirectories
-        std::vector<std::string> flac_files = findFilesWithExtension(output_dir3, ".flac");
-        std::cout << "  Extracted " << flac_files.size() << " stem files in FLAC format" << std::endl;
+// Test function to check that --opus-bitrate reaches the encoder
+bool testOpusBitrate(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Opus Bitrate Control ===" << std::endl;
 
-        // Verify file formats using 'file' utility
-        if (!flac_files.empty()) {
-            verifyFlacFormat(flac_files[0], 16); // Default to 16-bit
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::map<int, uintmax_t> total_sizes;
+    for (int bitrate : {32, 256}) {
+        std::string output_dir = output_dir_base + "_opus_" + std::to_string(bitrate);
+        std::filesystem::create_directories(output_dir);
+        std::string cmd = exe_path + " -i \"" + module_file + "\" -o \"" + output_dir + "\" --format opus --opus-bitrate " + std::to_string(bitrate);
+        if (!runCommand(cmd, "Extracting Opus stems at " + std::to_string(bitrate) + " kbps")) {
+            std::cerr << "✗ Opus extraction failed" << std::endl;
+            return false;
         }
-    } else {
-        std::cerr << "✗ FLAC format extraction failed" << std::endl;
-        std::filesystem::remove_all(output_dir3);
+        for (const auto& file : findFilesWithExtension(output_dir, ".opus")) {
+            total_sizes[bitrate] += std::filesystem::file_size(file);
+        }
+        std::filesystem::remove_all(output_dir);
+        std::cout << "  " << bitrate << " kbps: " << total_sizes[bitrate] << " bytes" << std::endl;
     }
 
-    // Test 4: Extraction with sinc resampling
-    std::string output_dir4 = output_dir + "_sinc";
-    std::filesystem::create_directory(output_dir4);
-    std::string cmd4 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir4 + "\" --resample sinc";
-    if (runCommand(cmd4, "Test 4: Extraction with sinc resampling")) {
-        std::cout << "✓ Sinc resampling extraction completed successfully" << std::endl;
+    if (total_sizes[32] == 0 || total_sizes[32] * 2 > total_sizes[256]) {
+        std::cerr << "  Bitrate setting had no visible effect on file size" << std::endl;
+        return false;
+    }
+    return true;
+}
 
-        // Count extracted files in subdirectories
-        std::vector<std::string> wav_files4 = findFilesWithExtension(output_dir4, ".wav");
-        std::cout << "  Extracted " << wav_files4.size() << " stem files with sinc resampling" << std::endl;
+// Reads a whole audio file as interleaved floats
+std::vector<float> readAudioSamples(const std::string& filepath) {
+    SF_INFO sf_info = {};
+    SNDFILE* file = sf_open(filepath.c_str(), SFM_READ, &sf_info);
+    if (!file) {
+        return {};
+    }
+    std::vector<float> samples(sf_info.frames * sf_info.channels);
+    sf_readf_float(file, samples.data(), sf_info.frames);
+    sf_close(file);
+    return samples;
+}
 
-        // Verify file formats using 'file' utility
-        if (!wav_files4.empty()) {
-            verifyWavFormat(wav_files4[0], 16); // Default to 16-bit
+// Sizes of the audio packets of an Ogg Opus file, after OpusHead and OpusTags
+std::vector<size_t> readOpusPacketSizes(const std::string& filepath) {
+    std::vector<size_t> sizes;
+    std::ifstream in(filepath, std::ios::binary);
+    size_t packet = 0;
+    int headers = 2;
+    unsigned char header[27];
+    while (in.read(reinterpret_cast<char*>(header), 27) &&
+           std::string(reinterpret_cast<char*>(header), 4) == "OggS") {
+        std::vector<unsigned char> lacing(header[26]);
+        if (!in.read(reinterpret_cast<char*>(lacing.data()), lacing.size())) {
+            break;
         }
-    } else {
-        std::cerr << "✗ Sinc resampling extraction failed" << std::endl;
-        std::filesystem::remove_all(output_dir4);
+        size_t body = 0;
+        for (unsigned char value : lacing) {
+            body += value;
+            packet += value;
+            // A lacing value under 255 ends the packet
+            if (value < 255) {
+                if (headers > 0) {
+                    --headers;
+                } else {
+                    sizes.push_back(packet);
+                }
+                packet = 0;
+            }
+        }
+        in.seekg(body, std::ios::cur);
     }
+    return sizes;
+}
 
-    // Test 5: Extraction with Opus format
-    std::string output_dir5 = output_dir + "_opus";
-    std::filesystem::create_directory(output_dir5);
-    std::string cmd5 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir5 + "\" --format opus --opus-bitrate 96 --sample-rate 48000";
-    if (runCommand(cmd5, "Test 5: Extraction with Opus format")) {
-        std::cout << "✓ Opus format extraction completed successfully" << std::endl;
+// Test function to check --opus-bitrate-mode, --opus-complexity,
+// --opus-frame-size and --encoder-threads. The encoder thread count must not
+// change the stems. Built without libopusenc, libsndfile ignores the other
+// three, so their effect on the packets is only checked with the native
+// encoder.
+bool testOpusOptions(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Opus Encoder Options ===" << std::endl;
 
-        // Count extracted files in subdirectories
-        std::vector<std::string> opus_files = findFilesWithExtension(output_dir5, ".opus");
-        std::cout << "  Extracted " << opus_files.size() << " stem files in Opus format" << std::endl;
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
 
-        // Verify file formats using 'file' utility
-        if (!opus_files.empty()) {
-            verifyOpusFormat(opus_files[0], 16); // Default to 16-bit
+    std::string default_dir = output_dir_base + "_opus_default_test";
+    std::string cheap_dir = output_dir_base + "_opus_cheap_test";
+    std::string cbr_dir = output_dir_base + "_opus_cbr_test";
+    std::string threads_dir = output_dir_base + "_opus_threads_test";
+    std::string log_path = output_dir_base + "_opus_options.log";
+    std::string input = " -i \"" + module_file + "\" --format opus";
+    std::string cbr = " --opus-bitrate-mode cbr --opus-frame-size 10";
+    std::string cmd_default = exe_path + input + " -o \"" + default_dir + "\" > \"" + log_path + "\"";
+    std::string cmd_cheap = exe_path + input + " -o \"" + cheap_dir + "\" --opus-complexity 0";
+    std::string cmd_cbr = exe_path + input + " -o \"" + cbr_dir + "\"" + cbr + " --encoder-threads 1";
+    std::string cmd_threads = exe_path + input + " -o \"" + threads_dir + "\"" + cbr + " --encoder-threads 4";
+    if (!runCommand(cmd_default, "Encoding Opus with the default options") ||
+        !runCommand(cmd_cheap, "Encoding Opus at complexity 0") ||
+        !runCommand(cmd_cbr, "Encoding Opus as CBR in 10 ms frames on one thread") ||
+        !runCommand(cmd_threads, "Encoding Opus as CBR in 10 ms frames on 4 threads")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+    std::ifstream log(log_path);
+    std::string output((std::istreambuf_iterator<char>(log)), std::istreambuf_iterator<char>());
+    bool native = output.find("libsndfile: bitrate mode") == std::string::npos;
+
+    std::vector<std::string> default_files = findFilesWithExtension(default_dir, ".opus");
+    if (default_files.empty()) {
+        std::cerr << "  No Opus stems written" << std::endl;
+        return false;
+    }
+    for (const auto& file : default_files) {
+        std::filesystem::path relative = std::filesystem::path(file).lexically_relative(default_dir);
+        std::string cheap_file = (std::filesystem::path(cheap_dir) / relative).string();
+        std::string cbr_file = (std::filesystem::path(cbr_dir) / relative).string();
+        std::string threads_file = (std::filesystem::path(threads_dir) / relative).string();
+
+        // Ogg serial numbers are random, so the decoded samples are compared
+        std::vector<float> decoded = readAudioSamples(cbr_file);
+        if (decoded.empty() || decoded != readAudioSamples(threads_file)) {
+            std::cerr << "  --encoder-threads changed the stem: " << relative.string() << std::endl;
+            return false;
+        }
+        if (!native) {
+            continue;
+        }
+
+        std::vector<size_t> vbr_packets = readOpusPacketSizes(file);
+        std::vector<size_t> cbr_packets = readOpusPacketSizes(cbr_file);
+        std::cout << "  " << relative.string() << ": " << vbr_packets.size() << " packets at 20 ms, "
+                  << cbr_packets.size() << " at 10 ms" << std::endl;
+        if (vbr_packets.size() < 3 || cbr_packets.size() < vbr_packets.size() * 9 / 5) {
+            std::cerr << "  --opus-frame-size was not applied" << std::endl;
+            return false;
+        }
+        // The first and last packets may be shorter in either mode
+        auto spread = [](const std::vector<size_t>& sizes) {
+            auto range = std::minmax_element(sizes.begin() + 1, sizes.end() - 1);
+            return *range.second - *range.first;
+        };
+        if (spread(cbr_packets) != 0 || spread(vbr_packets) == 0) {
+            std::cerr << "  --opus-bitrate-mode was not applied" << std::endl;
+            return false;
+        }
+        if (readAudioSamples(cheap_file) == readAudioSamples(file)) {
+            std::cerr << "  --opus-complexity was not applied" << std::endl;
+            return false;
         }
-    } else {
-        std::cerr << "✗ Opus format extraction failed" << std::endl;
-        std::filesystem::remove_all(output_dir5);
+    }
+    if (!native) {
+        std::cout << "  Built without libopusenc: only --encoder-threads checked" << std::endl;
     }
 
-    // Test 6: Extraction with 24-bit depth
-    std::string output_dir6 = output_dir + "_24bit";
-    std::filesystem::create_directory(output_dir6);
-    std::string cmd6 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir6 + "\" --format flac --bit-depth 24";
-    if (runCommand(cmd6, "Test 6: Extraction with 24-bit depth")) {
-        std::cout << "✓ 24-bit depth extraction completed successfully" << std::endl;
+    std::filesystem::remove_all(default_dir);
+    std::filesystem::remove_all(cheap_dir);
+    std::filesystem::remove_all(cbr_dir);
+    std::filesystem::remove_all(threads_dir);
+    std::filesystem::remove(log_path);
+    return true;
+}
 
-        // Count extracted files in subdirectories
-        std::vector<std::string> flac_files6 = findFilesWithExtension(output_dir6, ".flac");
-        std::cout << "  Extracted " << flac_files6.size() << " stem files with 24-bit depth" << std::endl;
+// Test function to check that several --sample-rate values come from one render
+bool testMultipleSampleRates(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Multiple Output Sample Rates ===" << std::endl;
 
-        // Verify file formats using 'file' utility
-        if (!flac_files6.empty()) {
-            verifyFlacFormat(flac_files6[0], 24); // Expect 24-bit
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string output_dir = output_dir_base + "_multirate_test";
+    std::filesystem::create_directories(output_dir);
+
+    std::string cmd = exe_path + " -i \"" + module_file + "\" -o \"" + output_dir + "\" --sample-rate 44100,48000";
+    if (!runCommand(cmd, "Extracting stems at 44100 and 48000 Hz")) {
+        std::cerr << "✗ Multi-rate extraction failed" << std::endl;
+        return false;
+    }
+
+    // Every 48 kHz stem must have a 44.1 kHz twin with the same duration
+    std::vector<std::string> files_48k;
+    for (const auto& file : findFilesWithExtension(output_dir, ".wav")) {
+        if (std::filesystem::path(file).parent_path().filename() == "48000") {
+            files_48k.push_back(file);
         }
-    } else {
-        std::cerr << "✗ 24-bit depth extraction failed" << std::endl;
-        std::filesystem::remove_all(output_dir6);
+    }
+    std::cout << "  Found " << files_48k.size() << " stems at 48000 Hz" << std::endl;
+    if (files_48k.empty()) {
+        return false;
     }
 
-    // NEW: Test 7: Stem length consistency
-    if (testStemLengthConsistency(test_module, output_dir)) {
-        std::cout << "✓ Stem length consistency test passed!" << std::endl;
-    } else {
-        std::cerr << "✗ Stem length consistency test failed!" << std::endl;
+    for (const auto& file : files_48k) {
+        std::filesystem::path path(file);
+        std::string twin = (path.parent_path().parent_path() / "44100" / path.filename()).string();
+        if (!std::filesystem::exists(twin)) {
+            std::cerr << "  Missing 44100 Hz stem: " << twin << std::endl;
+            return false;
+        }
+        sf_count_t frames_48k = getAudioFileFrameCount(file);
+        sf_count_t frames_44k = getAudioFileFrameCount(twin);
+        sf_count_t expected = (frames_48k * 44100 + 47999) / 48000;
+        if (frames_44k != expected) {
+            std::cerr << "  " << path.filename().string() << ": " << frames_44k
+                      << " frames at 44100 Hz, expected " << expected << std::endl;
+            return false;
+        }
+    }
+    std::filesystem::remove_all(output_dir);
+
+    // Opus codes 44100 Hz as 48000 Hz, so asking for both writes the Opus
+    // stems once, in the 48000 directory
+    std::string cmd_opus = exe_path + " -i \"" + module_file + "\" -o \"" + output_dir +
+                           "\" --sample-rate 44100,48000 --format wav,opus";
+    if (!runCommand(cmd_opus, "Extracting WAV and Opus stems at 44100 and 48000 Hz")) {
+        std::cerr << "✗ Multi-rate extraction failed" << std::endl;
+        return false;
+    }
+    std::map<std::string, size_t> opus_per_rate;
+    for (const auto& file : findFilesWithExtension(output_dir, ".opus")) {
+        opus_per_rate[std::filesystem::path(file).parent_path().filename().string()]++;
+    }
+    std::cout << "  Opus stems: " << opus_per_rate["48000"] << " at 48000 Hz, "
+              << opus_per_rate["44100"] << " at 44100 Hz" << std::endl;
+    if (opus_per_rate["48000"] != files_48k.size() || opus_per_rate["44100"] != 0) {
+        std::cerr << "  Expected the Opus stems only at 48000 Hz" << std::endl;
+        return false;
+    }
+
+    std::filesystem::remove_all(output_dir);
+    return true;
+}
+
+// Test function to check that quad WAV stems carry the quad speaker mask
+bool testQuadChannelMask(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Quad Channel Layout ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string output_dir = output_dir_base + "_quad_test";
+    std::filesystem::create_directories(output_dir);
+
+    std::string cmd = exe_path + " -i \"" + module_file + "\" -o \"" + output_dir + "\" --channels 4";
+    if (!runCommand(cmd, "Extracting quad stems")) {
+        std::cerr << "✗ Quad extraction failed" << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> wav_files = findFilesWithExtension(output_dir, ".wav");
+    if (wav_files.empty()) {
+        return false;
+    }
+
+    // WAVE_FORMAT_EXTENSIBLE fmt chunk: tag 0xFFFE, 4 channels, mask 0x33
+    for (const auto& file : wav_files) {
+        std::ifstream in(file, std::ios::binary);
+        std::string header(512, '\0');
+        in.read(&header[0], header.size());
+        size_t fmt = header.find("fmt ");
+        if (fmt == std::string::npos || fmt + 8 + 24 > header.size()) {
+            std::cerr << "  No fmt chunk: " << file << std::endl;
+            return false;
+        }
+        const unsigned char* chunk = reinterpret_cast<const unsigned char*>(header.data() + fmt + 8);
+        unsigned tag = chunk[0] | (chunk[1] << 8);
+        unsigned channels = chunk[2] | (chunk[3] << 8);
+        uint32_t mask = chunk[20] | (chunk[21] << 8) | (chunk[22] << 16) | (static_cast<uint32_t>(chunk[23]) << 24);
+        if (tag != 0xFFFE || channels != 4 || mask != 0x33) {
+            std::cerr << "  Unexpected layout in " << file << ": tag " << tag
+                      << ", " << channels << " channels, mask " << mask << std::endl;
+            return false;
+        }
+    }
+    std::cout << "  " << wav_files.size() << " quad stems have the quad speaker mask" << std::endl;
+
+    std::filesystem::remove_all(output_dir);
+    return true;
+}
+
+// Test function to check that --generic-kernels writes byte-identical stems:
+// the specialised render, interleaving and conversion loops must only be
+// faster, for every channel count and sample type they are picked for
+bool testGenericKernels(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Generic Kernels ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    for (int channels : {1, 2, 4}) {
+        for (int bit_depth : {16, 24}) {
+            std::string suffix = std::to_string(channels) + "ch_" + std::to_string(bit_depth);
+            std::string specialised_dir = output_dir_base + "_kernels_" + suffix;
+            std::string generic_dir = output_dir_base + "_generic_" + suffix;
+            std::string options = " -i \"" + module_file + "\" --format wav,flac --peaks --channels " +
+                                  std::to_string(channels) + " --bit-depth " + std::to_string(bit_depth);
+            std::string cmd_specialised = exe_path + options + " -o \"" + specialised_dir + "\"";
+            std::string cmd_generic = exe_path + options + " -o \"" + generic_dir + "\" --generic-kernels";
+            if (!runCommand(cmd_specialised, "Extracting " + suffix + " stems with specialised kernels") ||
+                !runCommand(cmd_generic, "Extracting " + suffix + " stems with generic kernels")) {
+                std::cerr << "✗ Extraction failed" << std::endl;
+                return false;
+            }
+            if (!compareOutputTrees(specialised_dir, generic_dir, {".wav", ".flac", ".dat"})) {
+                return false;
+            }
+            std::filesystem::remove_all(specialised_dir);
+            std::filesystem::remove_all(generic_dir);
+        }
+    }
+    return true;
+}
+
+// Test function to check planar rendering at each channel count: the stems
+// have the requested channels and the same length, and the peaks, built
+// from the planar channel arrays, match each channel of the interleaved WAV
+bool testPlanarChannels(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Planar Rendering ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    const int spp = 256;
+    sf_count_t expected_frames = -1;
+    for (int channels : {1, 2, 4}) {
+        std::string output_dir = output_dir_base + "_planar_" + std::to_string(channels);
+        std::string cmd = exe_path + " -i \"" + module_file + "\" -o \"" + output_dir +
+                          "\" --bit-depth 24 --peaks --channels " + std::to_string(channels);
+        if (!runCommand(cmd, "Extracting " + std::to_string(channels) + "-channel stems with peaks")) {
+            std::cerr << "✗ Extraction failed" << std::endl;
+            return false;
+        }
+
+        std::vector<std::string> wav_files = findFilesWithExtension(output_dir, ".wav");
+        if (wav_files.empty()) {
+            return false;
+        }
+        for (const auto& file : wav_files) {
+            SF_INFO sf_info = {};
+            SNDFILE* sf = sf_open(file.c_str(), SFM_READ, &sf_info);
+            if (!sf) {
+                return false;
+            }
+            sf_close(sf);
+            if (sf_info.channels != channels) {
+                std::cerr << "  " << file << " has " << sf_info.channels << " channels" << std::endl;
+                return false;
+            }
+            if (expected_frames < 0) {
+                expected_frames = sf_info.frames;
+            } else if (sf_info.frames != expected_frames) {
+                std::cerr << "  " << file << " has " << sf_info.frames << " frames, expected "
+                          << expected_frames << std::endl;
+                return false;
+            }
+
+            std::string dat = file.substr(0, file.size() - 4) + "." + std::to_string(spp) + ".dat";
+            std::ifstream in(dat, std::ios::binary);
+            int32_t header[6] = {0};
+            in.read(reinterpret_cast<char*>(header), sizeof(header));
+            if (!in || header[5] != channels) {
+                std::cerr << "  Missing " << channels << "-channel peaks: " << dat << std::endl;
+                return false;
+            }
+            std::vector<int16_t> peaks(static_cast<size_t>(header[4]) * channels * 2);
+            in.read(reinterpret_cast<char*>(peaks.data()), peaks.size() * sizeof(int16_t));
+
+            // The WAV holds 24-bit samples, so allow one 16-bit step
+            std::vector<float> samples = readAudioSamples(file);
+            size_t pixels = (samples.size() / channels + spp - 1) / spp;
+            if (!in || pixels != static_cast<size_t>(header[4])) {
+                std::cerr << "  Peaks length does not match " << file << std::endl;
+                return false;
+            }
+            for (size_t p = 0; p < pixels; ++p) {
+                for (int c = 0; c < channels; ++c) {
+                    float lo = 1.0f, hi = -1.0f;
+                    for (size_t f = p * spp; f < std::min((p + 1) * spp, samples.size() / channels); ++f) {
+                        lo = std::min(lo, samples[f * channels + c]);
+                        hi = std::max(hi, samples[f * channels + c]);
+                    }
+                    const int16_t* pixel = &peaks[(p * channels + c) * 2];
+                    if (std::abs(std::lrint(lo * 32767.0f) - pixel[0]) > 1 ||
+                        std::abs(std::lrint(hi * 32767.0f) - pixel[1]) > 1) {
+                        std::cerr << "  Channel " << c << " of " << file << " differs from its peaks at pixel "
+                                  << p << std::endl;
+                        return false;
+                    }
+                }
+            }
+        }
+        std::cout << "  " << wav_files.size() << " stems with " << channels
+                  << " channels match their peaks" << std::endl;
+        std::filesystem::remove_all(output_dir);
+    }
+    return true;
+}
+
+// Test function to check that render workers, pinned or not and with or
+// without huge page buffers, write the same stems and report as one worker
+bool testRenderWorkers(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Render Workers ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string serial_dir = output_dir_base + "_one_worker_test";
+    std::string jobs_dir = output_dir_base + "_jobs_test";
+    std::string pinned_dir = output_dir_base + "_pinned_test";
+    std::string log_path = output_dir_base + "_workers.log";
+    std::string input = " -i \"" + module_file + "\"";
+    std::string cmd_serial = exe_path + input + " -o \"" + serial_dir + "\" --jobs 1";
+    std::string cmd_jobs = exe_path + input + " -o \"" + jobs_dir + "\" --jobs 3";
+    std::string cmd_pinned = exe_path + input + " -o \"" + pinned_dir +
+                             "\" --jobs 3 --pin-workers --huge-pages > \"" + log_path + "\"";
+    if (!runCommand(cmd_serial, "Extracting stems with one worker") ||
+        !runCommand(cmd_jobs, "Extracting stems with 3 workers") ||
+        !runCommand(cmd_pinned, "Extracting stems with 3 pinned workers and huge page buffers")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+
+    if (!compareOutputTrees(serial_dir, jobs_dir, {".wav", ".json"}) ||
+        !compareOutputTrees(serial_dir, pinned_dir, {".wav", ".json"})) {
+        return false;
+    }
+    std::ifstream log(log_path);
+    std::string output((std::istreambuf_iterator<char>(log)), std::istreambuf_iterator<char>());
+    if (output.find("Render workers: 3, pinned, huge page buffers") == std::string::npos) {
+        std::cerr << "  The run summary does not show the pinned workers" << std::endl;
+        return false;
+    }
+
+    std::filesystem::remove_all(serial_dir);
+    std::filesystem::remove_all(jobs_dir);
+    std::filesystem::remove_all(pinned_dir);
+    std::filesystem::remove(log_path);
+    return true;
+}
+
+// Test function to check that parallel workers under a memory budget
+// write the same stems as a single worker
+bool testParallelMemoryBudget(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Parallel Workers With Memory Budget ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string serial_dir = output_dir_base + "_serial_test";
+    std::string parallel_dir = output_dir_base + "_budget_test";
+    std::filesystem::create_directories(serial_dir);
+    std::filesystem::create_directories(parallel_dir);
+
+    std::string cmd_serial = exe_path + " -i \"" + module_file + "\" -o \"" + serial_dir + "\"";
+    std::string cmd_parallel = exe_path + " -i \"" + module_file + "\" -o \"" + parallel_dir + "\" --jobs 4 --max-memory 64M";
+    if (!runCommand(cmd_serial, "Extracting stems with one worker") ||
+        !runCommand(cmd_parallel, "Extracting stems with 4 workers and a 64 MiB budget")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+
+    if (!compareOutputTrees(serial_dir, parallel_dir)) {
+        return false;
+    }
+
+    std::filesystem::remove_all(serial_dir);
+    std::filesystem::remove_all(parallel_dir);
+    return true;
+}
+
+// Test function to check that --cpu-list, --nice and --sched-batch only
+// change where and when the work runs: the stems and report stay the same,
+// the pool is sized to the listed CPUs, and a bad CPU list is an error
+bool testSchedulingOptions(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Scheduling Options ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string default_dir = output_dir_base + "_unscheduled_test";
+    std::string scheduled_dir = output_dir_base + "_scheduled_test";
+    std::string log_path = output_dir_base + "_scheduling.log";
+    std::string input = " -i \"" + module_file + "\"";
+    std::string cmd_default = exe_path + input + " -o \"" + default_dir + "\"";
+    std::string cmd_scheduled = exe_path + input + " -o \"" + scheduled_dir +
+                                "\" --cpu-list 0 --nice 5 --sched-batch > \"" + log_path + "\"";
+    if (!runCommand(cmd_default, "Extracting stems with the default scheduling") ||
+        !runCommand(cmd_scheduled, "Extracting stems on CPU 0 at nice 5 with SCHED_BATCH")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+
+    if (!compareOutputTrees(default_dir, scheduled_dir, {".wav", ".json"})) {
+        return false;
+    }
+    std::ifstream log(log_path);
+    std::string output((std::istreambuf_iterator<char>(log)), std::istreambuf_iterator<char>());
+    if (output.find("Render workers: 1\n") == std::string::npos) {
+        std::cerr << "  The worker pool is not sized to the CPU list" << std::endl;
+        return false;
+    }
+    std::filesystem::remove_all(default_dir);
+    std::filesystem::remove_all(scheduled_dir);
+    std::filesystem::remove(log_path);
+
+    // Malformed, reversed, out of range and offline CPUs
+    for (const std::string list : {"abc", "3-1", "99999", "1000"}) {
+        std::string cmd = exe_path + input + " -o \"" + scheduled_dir + "\" --cpu-list " + list +
+                          " > /dev/null 2>&1";
+        if (runCommand(cmd, "Extracting stems with --cpu-list " + list)) {
+            std::cerr << "  --cpu-list " << list << " was accepted" << std::endl;
+            return false;
+        }
+        if (std::filesystem::exists(scheduled_dir) &&
+            !findFilesWithExtension(scheduled_dir, ".wav").empty()) {
+            std::cerr << "  Stems written with --cpu-list " << list << std::endl;
+            return false;
+        }
+    }
+    std::filesystem::remove_all(scheduled_dir);
+    return true;
+}
+
+// Test function to check --info metadata against an extraction: every
+// stem written must come from an instrument the patterns use
+bool testModuleInfo(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Module Metadata ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string output_dir = output_dir_base + "_info_test";
+    std::filesystem::create_directories(output_dir);
+    std::string info_path = output_dir + "/info.json";
+
+    std::string cmd_info = exe_path + " -i \"" + module_file + "\" --info > \"" + info_path + "\"";
+    std::string cmd_extract = exe_path + " -i \"" + module_file + "\" -o \"" + output_dir + "\"";
+    if (!runCommand(cmd_info, "Reading module metadata") ||
+        !runCommand(cmd_extract, "Extracting stems")) {
+        std::cerr << "✗ Command failed" << std::endl;
+        return false;
+    }
+
+    std::ifstream in(info_path);
+    std::string info((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (info.empty() || info[0] != '{' || info.find("\"instruments\": [") == std::string::npos) {
+        std::cerr << "  Unexpected metadata: " << info << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> wav_files = findFilesWithExtension(output_dir, ".wav");
+    for (const auto& file : wav_files) {
+        int index = std::stoi(std::filesystem::path(file).filename().string().substr(0, 3));
+        size_t entry = info.find("{\"index\": " + std::to_string(index) + ",");
+        size_t used = entry == std::string::npos ? entry : info.find("\"used\": ", entry);
+        if (used == std::string::npos || info.compare(used + 8, 4, "true") != 0) {
+            std::cerr << "  Stem " << index << " comes from an instrument marked unused" << std::endl;
+            return false;
+        }
+    }
+    std::cout << "  " << wav_files.size() << " stems, all from used instruments" << std::endl;
+
+    std::filesystem::remove_all(output_dir);
+    return true;
+}
+
+// Test function to check minus-one stems: each stem plus its minus-one
+// stem must add up to the same full mix
+bool testMinusOne(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Minus-One Stems ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string output_dir = output_dir_base + "_minus_one_test";
+    std::filesystem::create_directories(output_dir);
+
+    std::string cmd = exe_path + " -i \"" + module_file + "\" -o \"" + output_dir + "\" --minus-one";
+    if (!runCommand(cmd, "Extracting stems with minus-one stems")) {
+        std::cerr << "✗ Minus-one extraction failed" << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> stems;
+    for (const auto& file : findFilesWithExtension(output_dir, ".wav")) {
+        if (std::filesystem::path(file).parent_path().filename() != "minus_one") {
+            stems.push_back(file);
+        }
+    }
+    if (stems.empty()) {
+        return false;
+    }
+
+    // 16-bit rounding of two files on each side
+    const float tolerance = 4.0f / 32768.0f;
+    std::vector<float> reference;
+    for (const auto& file : stems) {
+        std::filesystem::path path(file);
+        std::string minus_file = (path.parent_path() / "minus_one" / path.filename()).string();
+        std::vector<float> stem = readAudioSamples(file);
+        std::vector<float> minus = readAudioSamples(minus_file);
+        if (minus.size() != stem.size()) {
+            std::cerr << "  Missing or mismatched minus-one stem: " << minus_file << std::endl;
+            return false;
+        }
+        for (size_t i = 0; i < stem.size(); ++i) {
+            minus[i] += stem[i];
+        }
+        if (reference.empty()) {
+            reference = minus;
+            continue;
+        }
+        for (size_t i = 0; i < reference.size(); ++i) {
+            if (std::fabs(reference[i] - minus[i]) > tolerance) {
+                std::cerr << "  " << path.filename().string() << " and its minus-one stem do not add up to the full mix" << std::endl;
+                return false;
+            }
+        }
+    }
+    std::cout << "  " << stems.size() << " stems add up to the same mix with their minus-one stems" << std::endl;
+
+    std::filesystem::remove_all(output_dir);
+    return true;
+}
+
+// Test function to check --split-by instrument-channel: the channel stems
+// of each instrument must add up to that instrument's stem
+bool testSplitByInstrumentChannel(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Instrument-Channel Stems ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string instrument_dir = output_dir_base + "_split_instrument_test";
+    std::string pair_dir = output_dir_base + "_split_pair_test";
+    std::filesystem::create_directories(instrument_dir);
+    std::filesystem::create_directories(pair_dir);
+
+    std::string cmd_instrument = exe_path + " -i \"" + module_file + "\" -o \"" + instrument_dir + "\"";
+    std::string cmd_pair = exe_path + " -i \"" + module_file + "\" -o \"" + pair_dir + "\" --split-by instrument-channel";
+    if (!runCommand(cmd_instrument, "Extracting instrument stems") ||
+        !runCommand(cmd_pair, "Extracting instrument-channel stems")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+
+    // Pair stems are named {instrument}-ch{channel}-{name}
+    std::map<std::string, std::vector<float>> sums;
+    std::vector<std::string> pair_files = findFilesWithExtension(pair_dir, ".wav");
+    for (const auto& file : pair_files) {
+        std::string filename = std::filesystem::path(file).filename().string();
+        if (filename.compare(3, 3, "-ch") != 0) {
+            std::cerr << "  Unexpected stem name: " << filename << std::endl;
+            return false;
+        }
+        std::vector<float> samples = readAudioSamples(file);
+        std::vector<float>& sum = sums[filename.substr(0, 3)];
+        sum.resize(std::max(sum.size(), samples.size()), 0.0f);
+        for (size_t i = 0; i < samples.size(); ++i) {
+            sum[i] += samples[i];
+        }
+    }
+
+    std::vector<std::string> instrument_files = findFilesWithExtension(instrument_dir, ".wav");
+    if (instrument_files.empty() || sums.size() != instrument_files.size()) {
+        std::cerr << "  " << sums.size() << " instruments in pair stems, "
+                  << instrument_files.size() << " instrument stems" << std::endl;
+        return false;
+    }
+    for (const auto& file : instrument_files) {
+        std::string filename = std::filesystem::path(file).filename().string();
+        std::vector<float> samples = readAudioSamples(file);
+        const std::vector<float>& sum = sums[filename.substr(0, 3)];
+        // 16-bit rounding of every pair stem
+        const float tolerance = 8.0f / 32768.0f;
+        for (size_t i = 0; i < samples.size(); ++i) {
+            if (i >= sum.size() || std::fabs(sum[i] - samples[i]) > tolerance) {
+                std::cerr << "  Channel stems do not add up to " << filename << std::endl;
+                return false;
+            }
+        }
+    }
+    std::cout << "  " << pair_files.size() << " instrument-channel stems add up to "
+              << instrument_files.size() << " instrument stems" << std::endl;
+
+    std::filesystem::remove_all(instrument_dir);
+    std::filesystem::remove_all(pair_dir);
+    return true;
+}
+
+// Test function to check that forked render workers write the same stems
+// and report as a single worker
+bool testProcessWorkers(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Process Workers ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string serial_dir = output_dir_base + "_thread_worker_test";
+    std::string process_dir = output_dir_base + "_process_worker_test";
+    std::filesystem::create_directories(serial_dir);
+    std::filesystem::create_directories(process_dir);
+
+    std::string cmd_serial = exe_path + " -i \"" + module_file + "\" -o \"" + serial_dir + "\"";
+    std::string cmd_process = exe_path + " -i \"" + module_file + "\" -o \"" + process_dir + "\" --workers-mode process --jobs 3";
+    if (!runCommand(cmd_serial, "Extracting stems with one worker") ||
+        !runCommand(cmd_process, "Extracting stems with 3 worker processes")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+
+    if (!compareOutputTrees(serial_dir, process_dir, {".wav", ".json"})) {
+        return false;
+    }
+
+    std::filesystem::remove_all(serial_dir);
+    std::filesystem::remove_all(process_dir);
+    return true;
+}
+
+// Test function to check that a batch with modules loaded ahead writes the
+// same stems as one loading each module when its turn comes
+bool testBatchPrefetch(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Batch Prefetch ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string input_dir = output_dir_base + "_batch_input";
+    std::string serial_dir = output_dir_base + "_batch_serial_test";
+    std::string prefetch_dir = output_dir_base + "_batch_prefetch_test";
+    std::filesystem::create_directories(input_dir);
+    std::string extension = std::filesystem::path(module_file).extension().string();
+    for (const char* name : {"first", "second", "third"}) {
+        std::filesystem::copy_file(module_file, input_dir + "/" + name + extension,
+                                   std::filesystem::copy_options::overwrite_existing);
+    }
+
+    // The copies are identical; every one of them renders with --no-dedupe
+    std::string cmd_serial = exe_path + " -i \"" + input_dir + "\" -o \"" + serial_dir + "\" --prefetch 0 --no-dedupe";
+    std::string cmd_prefetch = exe_path + " -i \"" + input_dir + "\" -o \"" + prefetch_dir + "\" --prefetch 2 --no-dedupe";
+    if (!runCommand(cmd_serial, "Extracting a batch without prefetch") ||
+        !runCommand(cmd_prefetch, "Extracting a batch with 2 modules prefetched")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+
+    if (!compareOutputTrees(serial_dir, prefetch_dir)) {
+        return false;
+    }
+
+    std::filesystem::remove_all(input_dir);
+    std::filesystem::remove_all(serial_dir);
+    std::filesystem::remove_all(prefetch_dir);
+    return true;
+}
+
+// Helper function to write a zip archive holding one stored (uncompressed)
+// entry
+bool writeStoredZip(const std::string& zip_path, const std::string& entry_name, const std::string& data) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (unsigned char byte : data) {
+        crc ^= byte;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    crc = ~crc;
+
+    auto le = [](std::string& out, uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            out += static_cast<char>((value >> (8 * i)) & 0xFF);
+        }
+    };
+    uint32_t size = static_cast<uint32_t>(data.size());
+    uint32_t name_size = static_cast<uint32_t>(entry_name.size());
+
+    std::string zip;
+    le(zip, 0x04034b50, 4); le(zip, 20, 2); le(zip, 0, 2); le(zip, 0, 2);
+    le(zip, 0, 4); le(zip, crc, 4); le(zip, size, 4); le(zip, size, 4);
+    le(zip, name_size, 2); le(zip, 0, 2);
+    zip += entry_name + data;
+
+    uint32_t directory_offset = static_cast<uint32_t>(zip.size());
+    le(zip, 0x02014b50, 4); le(zip, 20, 2); le(zip, 20, 2); le(zip, 0, 2); le(zip, 0, 2);
+    le(zip, 0, 4); le(zip, crc, 4); le(zip, size, 4); le(zip, size, 4);
+    le(zip, name_size, 2); le(zip, 0, 2); le(zip, 0, 2); le(zip, 0, 2); le(zip, 0, 2);
+    le(zip, 0, 4); le(zip, 0, 4);
+    zip += entry_name;
+    uint32_t directory_size = static_cast<uint32_t>(zip.size()) - directory_offset;
+
+    le(zip, 0x06054b50, 4); le(zip, 0, 2); le(zip, 0, 2); le(zip, 1, 2); le(zip, 1, 2);
+    le(zip, directory_size, 4); le(zip, directory_offset, 4); le(zip, 0, 2);
+
+    std::ofstream out(zip_path, std::ios::binary);
+    out.write(zip.data(), zip.size());
+    return static_cast<bool>(out);
+}
+
+// Test function to check that a module read from a zip archive or from
+// standard input renders the same stems as the module file
+bool testArchiveAndStdinInput(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Archive and Standard Input ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string file_dir = output_dir_base + "_input_file_test";
+    std::string zip_dir = output_dir_base + "_input_zip_test";
+    std::string stdin_dir = output_dir_base + "_input_stdin_test";
+    std::string zip_path = output_dir_base + "_input_pack.zip";
+    std::filesystem::create_directories(file_dir);
+
+    std::ifstream in(module_file, std::ios::binary);
+    std::string module_data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::string file_name = std::filesystem::path(module_file).filename().string();
+    if (!writeStoredZip(zip_path, "modules/" + file_name, module_data)) {
+        std::cerr << "✗ Could not write " << zip_path << std::endl;
+        return false;
+    }
+
+    std::string cmd_file = exe_path + " -i \"" + module_file + "\" -o \"" + file_dir + "\"";
+    std::string cmd_zip = exe_path + " -i \"" + zip_path + "\" -o \"" + zip_dir + "\"";
+    std::string cmd_stdin = exe_path + " -i - -o \"" + stdin_dir + "\" < \"" + module_file + "\"";
+    if (!runCommand(cmd_file, "Extracting stems from the module file") ||
+        !runCommand(cmd_zip, "Extracting stems from a zip archive") ||
+        !runCommand(cmd_stdin, "Extracting stems from standard input")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+
+    std::string module_name = std::filesystem::path(module_file).stem().string();
+    std::string file_stems = file_dir + "/" + module_name;
+    if (!compareOutputTrees(file_stems, zip_dir + "/" + module_name) ||
+        !compareOutputTrees(file_stems, stdin_dir + "/stdin")) {
+        return false;
+    }
+
+    // Tape and block devices pad gzip files with zeros after the last member
+    std::string gzip_dir = output_dir_base + "_input_gzip_test";
+    std::string gzip_path = output_dir_base + "_input_" + file_name + ".gz";
+    bool have_gzip = std::system("gzip --version > /dev/null 2>&1") == 0;
+    if (have_gzip) {
+        std::string cmd_gzip = "gzip -c \"" + module_file + "\" > \"" + gzip_path + "\"";
+        std::string cmd_padded = exe_path + " -i \"" + gzip_path + "\" -o \"" + gzip_dir + "\"";
+        if (std::system(cmd_gzip.c_str()) != 0) {
+            std::cerr << "✗ Could not write " << gzip_path << std::endl;
+            return false;
+        }
+        std::ofstream(gzip_path, std::ios::binary | std::ios::app) << std::string(512, '\0');
+        if (!runCommand(cmd_padded, "Extracting stems from a zero-padded gzip file") ||
+            !compareOutputTrees(file_stems, gzip_dir + "/" + std::filesystem::path(gzip_path).stem().stem().string())) {
+            std::cerr << "✗ Zero-padded gzip input failed" << std::endl;
+            return false;
+        }
+    } else {
+        std::cout << "  gzip not found, skipping the zero-padded gzip input" << std::endl;
+    }
+
+    std::filesystem::remove_all(file_dir);
+    std::filesystem::remove_all(zip_dir);
+    std::filesystem::remove_all(stdin_dir);
+    std::filesystem::remove_all(gzip_dir);
+    std::filesystem::remove(zip_path);
+    std::filesystem::remove(gzip_path);
+    return true;
+}
+
+// Test function to check that a batch skips files that are not modules
+// without counting them as failures
+bool testNonModuleSkipped(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Non-Module Files Skipped ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string input_dir = output_dir_base + "_mixed_input";
+    std::string output_dir = output_dir_base + "_mixed_test";
+    std::filesystem::create_directories(input_dir);
+    std::filesystem::copy_file(module_file, input_dir + "/" + std::filesystem::path(module_file).filename().string(),
+                               std::filesystem::copy_options::overwrite_existing);
+    std::ofstream(input_dir + "/notes.txt") << "These are not the modules you are looking for.\n";
+
+    std::string cmd = exe_path + " -i \"" + input_dir + "\" -o \"" + output_dir + "\"";
+    if (!runCommand(cmd, "Extracting a batch with a text file among the modules")) {
+        std::cerr << "✗ The text file failed the batch" << std::endl;
+        return false;
+    }
+
+    std::string module_name = std::filesystem::path(module_file).stem().string();
+    bool module_written = !findFilesWithExtension(output_dir + "/" + module_name, ".wav").empty();
+    bool text_skipped = !std::filesystem::exists(output_dir + "/notes");
+    std::cout << "  Module stems written: " << (module_written ? "yes" : "no")
+              << ", text file skipped: " << (text_skipped ? "yes" : "no") << std::endl;
+
+    std::filesystem::remove_all(input_dir);
+    std::filesystem::remove_all(output_dir);
+    return module_written && text_skipped;
+}
+
+// Test function to check that a byte-identical copy of a module in a batch
+// gets hardlinks to the stems of the first copy and a report naming it
+bool testDuplicateModules(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Duplicate Modules ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string input_dir = output_dir_base + "_duplicate_input";
+    std::string output_dir = output_dir_base + "_duplicate_test";
+    std::filesystem::create_directories(input_dir);
+    std::string extension = std::filesystem::path(module_file).extension().string();
+    for (const char* name : {"first", "second"}) {
+        std::filesystem::copy_file(module_file, input_dir + "/" + name + extension,
+                                   std::filesystem::copy_options::overwrite_existing);
+    }
+
+    std::string cmd = exe_path + " -i \"" + input_dir + "\" -o \"" + output_dir + "\"";
+    if (!runCommand(cmd, "Extracting a batch with a duplicate module")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> stems = findFilesWithExtension(output_dir + "/first", ".wav");
+    std::vector<std::string> copies = findFilesWithExtension(output_dir + "/second", ".wav");
+    std::cout << "  " << stems.size() << " stems of the first copy, " << copies.size()
+              << " of the second" << std::endl;
+    if (stems.empty() || stems.size() != copies.size()) {
+        return false;
+    }
+    for (const auto& stem : stems) {
+        std::filesystem::path copy = std::filesystem::path(output_dir) / "second" / std::filesystem::path(stem).filename();
+        if (!std::filesystem::exists(copy) || std::filesystem::hard_link_count(copy) < 2) {
+            std::cerr << "  Not linked to the first copy: " << copy.string() << std::endl;
+            return false;
+        }
+    }
+
+    std::ifstream in(output_dir + "/second/report.json");
+    std::string report((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (report.find("\"module\": \"second\"") == std::string::npos ||
+        report.find("\"duplicate_of\"") == std::string::npos) {
+        std::cerr << "  Report of the second copy does not name the first" << std::endl;
+        return false;
+    }
+
+    // A directory in place of the second copy's report makes linking fail;
+    // the second copy is then rendered on its own
+    std::string blocked_dir = output_dir_base + "_duplicate_blocked_test";
+    std::filesystem::create_directories(blocked_dir + "/second/report.json/blocker");
+    std::string cmd_blocked = exe_path + " -i \"" + input_dir + "\" -o \"" + blocked_dir + "\"";
+    if (!runCommand(cmd_blocked, "Extracting a batch whose duplicate cannot be linked") ||
+        !compareOutputTrees(output_dir + "/first", blocked_dir + "/second")) {
+        std::cerr << "✗ The duplicate was not rendered after linking failed" << std::endl;
+        return false;
+    }
+    for (const auto& copy : findFilesWithExtension(blocked_dir + "/second", ".wav")) {
+        if (std::filesystem::hard_link_count(copy) != 1) {
+            std::cerr << "  Rendered stem is still linked: " << copy << std::endl;
+            return false;
+        }
+    }
+
+    std::filesystem::remove_all(input_dir);
+    std::filesystem::remove_all(output_dir);
+    std::filesystem::remove_all(blocked_dir);
+    return true;
+}
+
+// A note of a generated ProTracker module: a sample (from 1) played on a
+// channel at a row of the only pattern, with an optional effect
+struct ModNote {
+    int row;
+    int channel;
+    int sample;
+    int effect = 0;
+    int param = 0;
+};
+
+// Helper function to write a one-pattern, four-channel ProTracker module
+// from named samples of signed 8-bit data and the notes that play them
+bool writeTestMod(const std::string& path, const std::string& title,
+                  const std::vector<std::pair<std::string, std::string>>& samples,
+                  const std::vector<ModNote>& notes) {
+    std::string mod(20, '\0');
+    mod.replace(0, std::min<size_t>(title.size(), 20), title.substr(0, 20));
+    for (int i = 0; i < 31; ++i) {
+        std::string header(30, '\0');
+        if (static_cast<size_t>(i) < samples.size()) {
+            const std::string& name = samples[i].first;
+            int words = static_cast<int>(samples[i].second.size() / 2);
+            header.replace(0, std::min<size_t>(name.size(), 22), name.substr(0, 22));
+            header[22] = static_cast<char>(words >> 8);
+            header[23] = static_cast<char>(words & 0xFF);
+            header[25] = 64; // volume
+        }
+        header[29] = 1; // no loop
+        mod += header;
+    }
+    mod += static_cast<char>(1);   // song length
+    mod += static_cast<char>(127); // restart position
+    mod += std::string(128, '\0'); // order list: pattern 0
+    mod += "M.K.";
+
+    std::string pattern(64 * 4 * 4, '\0');
+    const int period = 428;
+    for (const ModNote& note : notes) {
+        char* cell = &pattern[(note.row * 4 + note.channel) * 4];
+        cell[0] = static_cast<char>((note.sample & 0xF0) | (period >> 8));
+        cell[1] = static_cast<char>(period & 0xFF);
+        cell[2] = static_cast<char>(((note.sample & 0x0F) << 4) | (note.effect & 0x0F));
+        cell[3] = static_cast<char>(note.param);
+    }
+    mod += pattern;
+
+    for (const auto& sample : samples) {
+        mod += sample.second;
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(mod.data(), mod.size());
+    return static_cast<bool>(out);
+}
+
+// A decaying sine of signed 8-bit samples, an even number of bytes long
+std::string decayingSine(size_t bytes) {
+    std::string data(bytes, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(static_cast<int>(std::lround(100 * std::sin(i * 0.07) * (1.0 - i / double(bytes)))));
+    }
+    return data;
+}
+
+// Helper function to write a ProTracker module whose first two samples hold
+// the same data and play together on channels 1 and 4, which share their
+// panning, so both render the same stem
+bool writeTwinSampleMod(const std::string& path) {
+    std::string data = decayingSine(2000);
+    return writeTestMod(path, "twin test", {{"Twin A", data}, {"Twin B", data}},
+                        {{0, 0, 1}, {0, 3, 2}});
+}
+
+// Test function to check that a stem rendering the same audio as an earlier
+// one is recorded as its alias, and hardlinked to it unless it is Ogg
+bool testIdenticalStems(const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Identical Stems ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string output_dir = output_dir_base + "_identical_test";
+    std::string module_path = output_dir_base + "_twins.mod";
+    if (!writeTwinSampleMod(module_path)) {
+        std::cerr << "✗ Could not write " << module_path << std::endl;
+        return false;
+    }
+
+    // The peaks files of the twins are linked along with the stems
+    for (const std::string format : {"dat", "json"}) {
+        std::string cmd = exe_path + " -i \"" + module_path + "\" -o \"" + output_dir +
+                          "\" --peaks --peaks-levels 2 --peaks-format " + format;
+        if (!runCommand(cmd, "Extracting stems and " + format + " peaks of two identical samples")) {
+            std::cerr << "✗ Extraction failed" << std::endl;
+            return false;
+        }
+
+        std::string module_dir = output_dir + "/" + std::filesystem::path(module_path).stem().string();
+        std::filesystem::path first = module_dir + "/001-Twin_A.wav";
+        std::filesystem::path second = module_dir + "/002-Twin_B.wav";
+        if (!std::filesystem::exists(first) || !std::filesystem::exists(second)) {
+            std::cerr << "  Missing stems of the twin samples" << std::endl;
+            return false;
+        }
+        bool linked = std::filesystem::equivalent(first, second);
+        bool peaks_linked = true;
+        for (const std::string spp : {"256", "512"}) {
+            std::filesystem::path first_peaks = module_dir + "/001-Twin_A." + spp + "." + format;
+            std::filesystem::path second_peaks = module_dir + "/002-Twin_B." + spp + "." + format;
+            peaks_linked = peaks_linked && std::filesystem::exists(first_peaks) &&
+                           std::filesystem::exists(second_peaks) &&
+                           std::filesystem::equivalent(first_peaks, second_peaks);
+        }
+        std::ifstream in(module_dir + "/report.json");
+        std::string report((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        bool aliased = report.find("\"alias_of\": \"001-Twin_A.wav\"") != std::string::npos;
+        std::cout << "  Second stem linked: " << (linked ? "yes" : "no")
+                  << ", " << format << " peaks linked: " << (peaks_linked ? "yes" : "no")
+                  << ", alias in report: " << (aliased ? "yes" : "no") << std::endl;
+        std::filesystem::remove_all(output_dir);
+        if (!linked || !peaks_linked || !aliased) {
+            return false;
+        }
+    }
+
+    // Opus files never match byte for byte, but the twin is still an alias
+    std::string cmd = exe_path + " -i \"" + module_path + "\" -o \"" + output_dir + "\" --format opus";
+    if (!runCommand(cmd, "Extracting Opus stems of two identical samples")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+    std::string module_dir = output_dir + "/" + std::filesystem::path(module_path).stem().string();
+    std::ifstream in(module_dir + "/report.json");
+    std::string report((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    bool kept = std::filesystem::exists(module_dir + "/002-Twin_B.opus");
+    bool aliased = report.find("\"alias_of\": \"001-Twin_A.opus\"") != std::string::npos;
+    std::cout << "  Second Opus stem kept: " << (kept ? "yes" : "no")
+              << ", alias in report: " << (aliased ? "yes" : "no") << std::endl;
+    std::filesystem::remove_all(output_dir);
+    if (!kept || !aliased) {
+        return false;
+    }
+
+    std::filesystem::remove(module_path);
+    return true;
+}
+
+// Test function to check that a module longer than --max-duration is
+// rendered up to it and marked truncated in the report
+bool testRenderLimit(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Render Limit ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string full_dir = output_dir_base + "_limit_full_test";
+    std::string output_dir = output_dir_base + "_limit_test";
+    std::filesystem::create_directories(output_dir);
+
+    std::string cmd_full = exe_path + " -i \"" + module_file + "\" -o \"" + full_dir + "\"";
+    std::string cmd = exe_path + " -i \"" + module_file + "\" -o \"" + output_dir + "\" --max-duration 0.5";
+    if (!runCommand(cmd_full, "Extracting the whole module") ||
+        !runCommand(cmd, "Extracting stems with a 0.5 second limit")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+
+    // Each truncated stem is the first half second of the whole stem
+    const sf_count_t max_frames = 22050;
+    std::vector<std::string> stems = findFilesWithExtension(output_dir, ".wav");
+    sf_count_t longest = 0;
+    for (const auto& stem : stems) {
+        std::filesystem::path relative = std::filesystem::path(stem).lexically_relative(output_dir);
+        std::vector<float> truncated = readAudioSamples(stem);
+        std::vector<float> full = readAudioSamples((std::filesystem::path(full_dir) / relative).string());
+        sf_count_t frames = getAudioFileFrameCount(stem);
+        longest = std::max(longest, frames);
+        if (frames > max_frames || full.size() < truncated.size() ||
+            !std::equal(truncated.begin(), truncated.end(), full.begin())) {
+            std::cerr << "  " << relative.string() << " (" << frames
+                      << " frames) is not the start of the whole stem" << std::endl;
+            return false;
+        }
+    }
+    std::cout << "  " << stems.size() << " stems of at most " << longest << " frames" << std::endl;
+
+    std::vector<std::string> reports = findFilesWithExtension(output_dir, ".json");
+    if (stems.empty() || longest != max_frames || reports.size() != 1) {
+        std::cerr << "  Expected stems cut off at " << max_frames << " frames and one report" << std::endl;
+        return false;
+    }
+    std::ifstream in(reports.front());
+    std::string report((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (report.find("\"truncated\": true") == std::string::npos ||
+        report.find("\"render_limit\"") != std::string::npos) {
+        std::cerr << "  Report does not mark the module truncated" << std::endl;
+        return false;
+    }
+    std::filesystem::remove_all(output_dir);
+
+    // A stem timeout this short stops every stem after its first block;
+    // the module goes on with the next stem and reports each one stopped,
+    // with render threads and with forked workers
+    size_t full_stems = findFilesWithExtension(full_dir, ".wav").size();
+    for (const std::string workers : {"", " --workers-mode process --jobs 2"}) {
+        std::string cmd_stem = exe_path + " -i \"" + module_file + "\" -o \"" + output_dir +
+                               "\" --stem-timeout 0.000001" + workers;
+        std::cout << "\nExtracting stems with a 1 microsecond stem timeout" << workers << "..." << std::endl;
+        int status = std::system(cmd_stem.c_str());
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 3) {
+            std::cerr << "  Expected exit status 3 at the stem timeout" << std::endl;
+            return false;
+        }
+        reports = findFilesWithExtension(output_dir, ".json");
+        if (!findFilesWithExtension(output_dir, ".wav").empty() || reports.size() != 1) {
+            std::cerr << "  Expected no stems and one report" << std::endl;
+            return false;
+        }
+        std::ifstream stem_in(reports.front());
+        report.assign((std::istreambuf_iterator<char>(stem_in)), std::istreambuf_iterator<char>());
+        size_t stopped = 0;
+        for (size_t at = report.find("\"render_limit\": \"stem_timeout\"}"); at != std::string::npos;
+             at = report.find("\"render_limit\": \"stem_timeout\"}", at + 1)) {
+            stopped++;
+        }
+        std::cout << "  " << stopped << " of " << full_stems << " stems reported stopped" << std::endl;
+        if (report.find("\"render_limit\": \"stem_timeout\",") == std::string::npos ||
+            report.find("\"stopped_stems\"") == std::string::npos || stopped != full_stems) {
+            std::cerr << "  Report does not list the stems stopped at the stem timeout" << std::endl;
+            return false;
+        }
+        std::filesystem::remove_all(output_dir);
+    }
+
+    std::filesystem::remove_all(full_dir);
+    return true;
+}
+
+// Test function to check the silence probe on instrument-channel pairs
+// that cross: a sample heard on one channel and silenced on another, next
+// to a silent sample on the first channel, gives one stem only
+bool testCrossedPairProbe(const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Crossed Instrument-Channel Pairs ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string output_dir = output_dir_base + "_crossed_test";
+    std::string module_path = output_dir_base + "_crossed.mod";
+    // Sample 1 sounds on channel 1 and is set to volume 0 (C00) on
+    // channel 2; sample 2 holds only silence and plays on channel 1
+    if (!writeTestMod(module_path, "crossed test",
+                      {{"Heard", decayingSine(2000)}, {"Silence", std::string(2000, '\0')}},
+                      {{0, 0, 1}, {0, 1, 1, 0xC, 0}, {32, 0, 2}})) {
+        std::cerr << "✗ Could not write " << module_path << std::endl;
+        return false;
+    }
+
+    std::string cmd = exe_path + " -i \"" + module_path + "\" -o \"" + output_dir +
+                      "\" --split-by instrument-channel";
+    if (!runCommand(cmd, "Extracting crossed instrument-channel pairs")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> stems = findFilesWithExtension(output_dir, ".wav");
+    std::cout << "  " << stems.size() << " stems written" << std::endl;
+    for (const auto& stem : stems) {
+        std::cout << "    " << std::filesystem::path(stem).filename().string() << std::endl;
+    }
+
+    std::filesystem::remove_all(output_dir);
+    std::filesystem::remove(module_path);
+    return stems.size() == 1;
+}
+
+// Test function to check that the group-testing silence probe finds the
+// same stems as probing each stem on its own, by instrument and by pair
+bool testGroupProbe(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Group Silence Probe ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string grouped_dir = output_dir_base + "_group_probe_test";
+    std::string single_dir = output_dir_base + "_single_probe_test";
+    std::string crossed_path = output_dir_base + "_probe_crossed.mod";
+    if (!writeTestMod(crossed_path, "probe test",
+                      {{"Heard", decayingSine(2000)}, {"Silence", std::string(2000, '\0')}},
+                      {{0, 0, 1}, {0, 1, 1, 0xC, 0}, {32, 0, 2}, {48, 2, 1}})) {
+        std::cerr << "✗ Could not write " << crossed_path << std::endl;
+        return false;
+    }
+
+    struct Case { std::string module; std::string split; };
+    for (const Case& run : {Case{module_file, "instrument"}, Case{crossed_path, "instrument-channel"}}) {
+        std::string input = " -i \"" + run.module + "\" --split-by " + run.split;
+        std::string cmd_grouped = exe_path + input + " -o \"" + grouped_dir + "\"";
+        std::string cmd_single = exe_path + input + " -o \"" + single_dir + "\" --no-group-probe";
+        if (!runCommand(cmd_grouped, "Extracting by " + run.split + " with the group probe") ||
+            !runCommand(cmd_single, "Extracting by " + run.split + " probing each stem")) {
+            std::cerr << "✗ Extraction failed" << std::endl;
+            return false;
+        }
+        if (!compareOutputTrees(grouped_dir, single_dir)) {
+            return false;
+        }
+        std::filesystem::remove_all(grouped_dir);
+        std::filesystem::remove_all(single_dir);
+    }
+
+    std::filesystem::remove(crossed_path);
+    return true;
+}
+
+// Test function to check that FLAC stems encoded in parallel runs are the
+// same bytes as one encoder over the whole stem, and decode to the samples
+// of the WAV stems
+bool testFlacParallelEncode(const std::string& module_file, const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Parallel FLAC Encoding ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string wav_dir = output_dir_base + "_flac_reference_test";
+    std::string single_dir = output_dir_base + "_flac_single_test";
+    std::string parallel_dir = output_dir_base + "_flac_parallel_test";
+
+    // Level 0 has the smallest blocks, so even a short module spans several
+    // parallel runs of frames
+    std::string input = " -i \"" + module_file + "\"";
+    std::string cmd_wav = exe_path + input + " -o \"" + wav_dir + "\"";
+    std::string cmd_single = exe_path + input + " -o \"" + single_dir +
+                             "\" --format flac --flac-level 0 --flac-single-encoder";
+    std::string cmd_parallel = exe_path + input + " -o \"" + parallel_dir +
+                               "\" --format flac --flac-level 0 --encoder-threads 4";
+    if (!runCommand(cmd_wav, "Extracting WAV stems") ||
+        !runCommand(cmd_single, "Encoding FLAC stems with one encoder") ||
+        !runCommand(cmd_parallel, "Encoding FLAC stems on 4 threads")) {
+        std::cerr << "✗ Extraction failed" << std::endl;
+        return false;
+    }
+
+    // Whole files: STREAMINFO, seek table and every frame
+    if (!compareOutputTrees(single_dir, parallel_dir, {".flac"})) {
+        return false;
+    }
+
+    bool have_flac_tool = std::system("flac --version > /dev/null 2>&1") == 0;
+    for (const auto& file : findFilesWithExtension(parallel_dir, ".flac")) {
+        std::filesystem::path relative = std::filesystem::path(file).lexically_relative(parallel_dir);
+        std::filesystem::path wav = std::filesystem::path(wav_dir) / relative;
+        wav.replace_extension(".wav");
+        std::vector<float> decoded = readAudioSamples(file);
+        if (decoded.empty() || decoded != readAudioSamples(wav.string())) {
+            std::cerr << "  Decoded samples differ from the WAV stem: " << relative.string() << std::endl;
+            return false;
+        }
+        // flac -t also checks every frame CRC and the MD5 signature
+        if (have_flac_tool && std::system(("flac -t -s \"" + file + "\"").c_str()) != 0) {
+            std::cerr << "  flac -t rejects " << relative.string() << std::endl;
+            return false;
+        }
+    }
+    std::cout << "  Parallel stems decode to the WAV samples"
+              << (have_flac_tool ? " and pass flac -t" : "") << std::endl;
+
+    std::filesystem::remove_all(wav_dir);
+    std::filesystem::remove_all(single_dir);
+    std::filesystem::remove_all(parallel_dir);
+    return true;
+}
+
+// Reads one number field from a single-line JSON object, NaN when missing
+double jsonField(const std::string& json, const std::string& key) {
+    size_t at = json.find("\"" + key + "\": ");
+    if (at == std::string::npos) {
+        return NAN;
+    }
+    return std::strtod(json.c_str() + at + key.size() + 4, nullptr);
+}
+
+// Test function to check the loudness meter against the BS.1770 reference:
+// a 997 Hz sine at -20 dBFS reads -23 LUFS on one channel, and the same
+// sine on both channels of a stereo file sums to -20 LUFS
+bool testLoudnessAccuracy(const std::string& output_dir_base) {
+    std::cout << "\n=== Test: Loudness Meter Accuracy ===" << std::endl;
+
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return false;
+    }
+
+    std::string output_dir = output_dir_base + "_loudness_test";
+    std::filesystem::create_directories(output_dir);
+
+    const int sample_rate = 48000;
+    const int frames = sample_rate * 10;
+    const double amplitude = 0.1;
+    struct Case { int channels; double lufs; };
+    for (const Case& expected : {Case{1, -23.0}, Case{2, -20.0}}) {
+        std::string base = output_dir + "/sine" + std::to_string(expected.channels);
+        SF_INFO info = {};
+        info.samplerate = sample_rate;
+        info.channels = expected.channels;
+        info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+        SNDFILE* file = sf_open((base + ".wav").c_str(), SFM_WRITE, &info);
+        if (!file) {
+            std::cerr << "✗ Could not write " << base << ".wav" << std::endl;
+            return false;
+        }
+        std::vector<float> samples(size_t(frames) * expected.channels);
+        for (int i = 0; i < frames; i++) {
+            float value = float(amplitude * std::sin(2.0 * M_PI * 997.0 * i / sample_rate));
+            for (int c = 0; c < expected.channels; c++) {
+                samples[size_t(i) * expected.channels + c] = value;
+            }
+        }
+        sf_writef_float(file, samples.data(), frames);
+        sf_close(file);
+
+        std::string cmd = exe_path + " --measure-loudness \"" + base + ".wav\" > \"" + base + ".json\"";
+        if (!runCommand(cmd, "Measuring a " + std::to_string(expected.channels) + "-channel sine")) {
+            std::cerr << "✗ Measurement failed" << std::endl;
+            return false;
+        }
+        std::ifstream in(base + ".json");
+        std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        double lufs = jsonField(json, "integrated_lufs");
+        double true_peak = jsonField(json, "true_peak_dbtp");
+        std::cout << "  " << expected.channels << " channel(s): " << lufs << " LUFS, "
+                  << true_peak << " dBTP in " << jsonField(json, "seconds") << " s" << std::endl;
+        if (!(std::abs(lufs - expected.lufs) <= 0.1) || !(std::abs(true_peak + 20.0) <= 0.1)) {
+            std::cerr << "  Expected " << expected.lufs << " LUFS and -20 dBTP" << std::endl;
+            return false;
+        }
+    }
+
+    std::filesystem::remove_all(output_dir);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    std::cout << "=== Untracker Integration Test ===" << std::endl;
+
+    // Find the executable
+    std::string exe_path = findExecutable();
+    if (exe_path.empty()) {
+        return 1;
+    }
+    std::cout << "✓ untracker executable found at: " << exe_path << std::endl;
+
+    // Check if a test module file was provided
+    if (argc < 2) {
+        std::cerr << "USAGE: " << argv[0] << " <test_module_file>" << std::endl;
+        std::cerr << "Example: " << argv[0] << " test_module.xm" << std::endl;
+        return 1;
+    }
+
+    // Find the test module file
+    std::string test_module = findModuleFile(argv[1]);
+    if (test_module.empty()) {
+        return 1;
+    }
+    std::cout << "✓ Test module file found: " << test_module << std::endl;
+
+    // Create a temporary output directory for the test
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<> dis(1000, 9999);
+    std::string output_dir = OUTPUT_DIR_PREFIX + std::to_string(dis(gen));
+    std::filesystem::create_directory(output_dir);
+
+    std::cout << "✓ Created temporary output directory: " << output_dir << std::endl;
+
+    // Test 1: Basic extraction
+    std::string cmd1 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir + "\"";
+    if (runCommand(cmd1, "Test 1: Basic stem extraction")) {
+        std::cout << "✓ Basic extraction completed successfully" << std::endl;
+
+        // Count extracted files in subdirectories
+        std::vector<std::string> wav_files = findFilesWithExtension(output_dir, ".wav");
+        std::cout << "  Extracted " << wav_files.size() << " stem files" << std::endl;
+
+        // Verify file formats using 'file' utility
+        if (!wav_files.empty()) {
+            verifyWavFormat(wav_files[0], 16); // Default to 16-bit
+        }
+    } else {
+        std::cerr << "✗ Basic extraction failed" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 2: Extraction with higher sample rate
+    std::string output_dir2 = output_dir + "_48k";
+    std::filesystem::create_directory(output_dir2);
+    std::string cmd2 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir2 + "\" --sample-rate 48000";
+    if (runCommand(cmd2, "Test 2: Extraction with higher sample rate")) {
+        std::cout << "✓ High sample rate extraction completed successfully" << std::endl;
+
+        // Count extracted files in subdirectories
+        std::vector<std::string> wav_files2 = findFilesWithExtension(output_dir2, ".wav");
+        std::cout << "  Extracted " << wav_files2.size() << " stem files with high sample rate" << std::endl;
+
+        // Verify file formats using 'file' utility
+        if (!wav_files2.empty()) {
+            verifyWavFormat(wav_files2[0], 16); // Default to 16-bit
+        }
+    } else {
+        std::cerr << "✗ High sample rate extraction failed" << std::endl;
+        std::filesystem::remove_all(output_dir2);
+    }
+
+    // Test 3: Extraction with FLAC format
+    std::string output_dir3 = output_dir + "_flac";
+    std::filesystem::create_directory(output_dir3);
+    std::string cmd3 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir3 + "\" --format flac";
+    if (runCommand(cmd3, "Test 3: Extraction with FLAC format")) {
+        std::cout << "✓ FLAC format extraction completed successfully" << std::endl;
+
+        // Count extracted files in subdirectories
+        std::vector<std::string> flac_files = findFilesWithExtension(output_dir3, ".flac");
+        std::cout << "  Extracted " << flac_files.size() << " stem files in FLAC format" << std::endl;
+
+        // Verify file formats using 'file' utility
+        if (!flac_files.empty()) {
+            verifyFlacFormat(flac_files[0], 16); // Default to 16-bit
+        }
+    } else {
+        std::cerr << "✗ FLAC format extraction failed" << std::endl;
+        std::filesystem::remove_all(output_dir3);
+    }
+
+    // Test 4: Extraction with sinc resampling
+    std::string output_dir4 = output_dir + "_sinc";
+    std::filesystem::create_directory(output_dir4);
+    std::string cmd4 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir4 + "\" --resample sinc";
+    if (runCommand(cmd4, "Test 4: Extraction with sinc resampling")) {
+        std::cout << "✓ Sinc resampling extraction completed successfully" << std::endl;
+
+        // Count extracted files in subdirectories
+        std::vector<std::string> wav_files4 = findFilesWithExtension(output_dir4, ".wav");
+        std::cout << "  Extracted " << wav_files4.size() << " stem files with sinc resampling" << std::endl;
+
+        // Verify file formats using 'file' utility
+        if (!wav_files4.empty()) {
+            verifyWavFormat(wav_files4[0], 16); // Default to 16-bit
+        }
+    } else {
+        std::cerr << "✗ Sinc resampling extraction failed" << std::endl;
+        std::filesystem::remove_all(output_dir4);
+    }
+
+    // Test 5: Extraction with Opus format
+    std::string output_dir5 = output_dir + "_opus";
+    std::filesystem::create_directory(output_dir5);
+    std::string cmd5 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir5 + "\" --format opus --opus-bitrate 96 --sample-rate 48000";
+    if (runCommand(cmd5, "Test 5: Extraction with Opus format")) {
+        std::cout << "✓ Opus format extraction completed successfully" << std::endl;
+
+        // Count extracted files in subdirectories
+        std::vector<std::string> opus_files = findFilesWithExtension(output_dir5, ".opus");
+        std::cout << "  Extracted " << opus_files.size() << " stem files in Opus format" << std::endl;
+
+        // Verify file formats using 'file' utility
+        if (!opus_files.empty()) {
+            verifyOpusFormat(opus_files[0], 16); // Default to 16-bit
+        }
+    } else {
+        std::cerr << "✗ Opus format extraction failed" << std::endl;
+        std::filesystem::remove_all(output_dir5);
+    }
+
+    // Test 6: Extraction with 24-bit depth
+    std::string output_dir6 = output_dir + "_24bit";
+    std::filesystem::create_directory(output_dir6);
+    std::string cmd6 = exe_path + " -i \"" + test_module + "\" -o \"" + output_dir6 + "\" --format flac --bit-depth 24";
+    if (runCommand(cmd6, "Test 6: Extraction with 24-bit depth")) {
+        std::cout << "✓ 24-bit depth extraction completed successfully" << std::endl;
+
+        // Count extracted files in subdirectories
+        std::vector<std::string> flac_files6 = findFilesWithExtension(output_dir6, ".flac");
+        std::cout << "  Extracted " << flac_files6.size() << " stem files with 24-bit depth" << std::endl;
+
+        // Verify file formats using 'file' utility
+        if (!flac_files6.empty()) {
+            verifyFlacFormat(flac_files6[0], 24); // Expect 24-bit
+        }
+    } else {
+        std::cerr << "✗ 24-bit depth extraction failed" << std::endl;
+        std::filesystem::remove_all(output_dir6);
+    }
+
+    // NEW: Test 7: Stem length consistency
+    if (testStemLengthConsistency(test_module, output_dir)) {
+        std::cout << "✓ Stem length consistency test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Stem length consistency test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 8: Loudness report written alongside the stems
+    if (testModuleReport(output_dir)) {
+        std::cout << "✓ Module report test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Module report test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 9: Waveform peaks files
+    if (testPeaksFiles(test_module, output_dir)) {
+        std::cout << "✓ Waveform peaks test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Waveform peaks test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 10: FLAC encoder options show in the stems' metadata
+    if (testFlacOptions(test_module, output_dir)) {
+        std::cout << "✓ FLAC encoder options test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ FLAC encoder options test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 11: Opus bitrate is applied by the encoder
+    if (testOpusBitrate(test_module, output_dir)) {
+        std::cout << "✓ Opus bitrate test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Opus bitrate test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 12: Opus encoder options show in the stems' packets
+    if (testOpusOptions(test_module, output_dir)) {
+        std::cout << "✓ Opus encoder options test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Opus encoder options test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 13: Several output rates from a single render
+    if (testMultipleSampleRates(test_module, output_dir)) {
+        std::cout << "✓ Multiple sample rates test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Multiple sample rates test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 14: Quad stems carry a WAVE_FORMAT_EXTENSIBLE speaker mask
+    if (testQuadChannelMask(test_module, output_dir)) {
+        std::cout << "✓ Quad channel layout test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Quad channel layout test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 15: Generic kernels write the same bytes as specialised ones
+    if (testGenericKernels(test_module, output_dir)) {
+        std::cout << "✓ Generic kernels test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Generic kernels test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 16: Planar rendering writes each channel count correctly
+    if (testPlanarChannels(test_module, output_dir)) {
+        std::cout << "✓ Planar rendering test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Planar rendering test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 17: Pinned render workers with huge page buffers change nothing
+    if (testRenderWorkers(test_module, output_dir)) {
+        std::cout << "✓ Render workers test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Render workers test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 18: Parallel workers under a memory budget match a single worker
+    if (testParallelMemoryBudget(test_module, output_dir)) {
+        std::cout << "✓ Parallel memory budget test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Parallel memory budget test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 19: Scheduling options change nothing; bad CPU lists are errors
+    if (testSchedulingOptions(test_module, output_dir)) {
+        std::cout << "✓ Scheduling options test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Scheduling options test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 20: Metadata without rendering agrees with the extraction
+    if (testModuleInfo(test_module, output_dir)) {
+        std::cout << "✓ Module metadata test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Module metadata test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 21: Minus-one stems are the full mix without each stem
+    if (testMinusOne(test_module, output_dir)) {
+        std::cout << "✓ Minus-one test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Minus-one test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 22: Instrument-channel stems add up to the instrument stems
+    if (testSplitByInstrumentChannel(test_module, output_dir)) {
+        std::cout << "✓ Instrument-channel split test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Instrument-channel split test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 23: Forked render workers match a single worker
+    if (testProcessWorkers(test_module, output_dir)) {
+        std::cout << "✓ Process workers test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Process workers test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 24: A module over --max-duration is cut off, and stems over
+    // --stem-timeout are stopped and reported
+    if (testRenderLimit(test_module, output_dir)) {
+        std::cout << "✓ Render limit test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Render limit test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 25: Batch modules loaded ahead render the same stems
+    if (testBatchPrefetch(test_module, output_dir)) {
+        std::cout << "✓ Batch prefetch test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Batch prefetch test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 26: Modules read from a zip archive and stdin render the same
+    if (testArchiveAndStdinInput(test_module, output_dir)) {
+        std::cout << "✓ Archive and stdin input test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Archive and stdin input test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 27: Files that are not modules are skipped in a batch
+    if (testNonModuleSkipped(test_module, output_dir)) {
+        std::cout << "✓ Non-module skip test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Non-module skip test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 28: A duplicate module in a batch links the first copy's stems
+    if (testDuplicateModules(test_module, output_dir)) {
+        std::cout << "✓ Duplicate module test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Duplicate module test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 29: Stems of identical samples are linked to each other
+    if (testIdenticalStems(output_dir)) {
+        std::cout << "✓ Identical stems test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Identical stems test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 30: Crossed instrument-channel pairs keep their silent stems out
+    if (testCrossedPairProbe(output_dir)) {
+        std::cout << "✓ Crossed pair probe test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Crossed pair probe test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 31: FLAC runs encoded in parallel match a single encoder
+    if (testFlacParallelEncode(test_module, output_dir)) {
+        std::cout << "✓ Parallel FLAC encoding test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Parallel FLAC encoding test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 32: The loudness meter reads the BS.1770 reference levels
+    if (testLoudnessAccuracy(output_dir)) {
+        std::cout << "✓ Loudness meter accuracy test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Loudness meter accuracy test failed!" << std::endl;
+        std::filesystem::remove_all(output_dir);
+        return 1;
+    }
+
+    // Test 33: The group silence probe finds the stems a probe per stem does
+    if (testGroupProbe(test_module, output_dir)) {
+        std::cout << "✓ Group silence probe test passed!" << std::endl;
+    } else {
+        std::cerr << "✗ Group silence probe test failed!" << std::endl;
         std::filesystem::remove_all(output_dir);
         return 1;
     }
@@ -30,343 +30,4868 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <libopenmpt/libopenmpt.hpp>
 #include <libopenmpt/libopenmpt_ext.hpp>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <set>
 #include <sndfile.hh>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+#include "config.h"
+
+#ifdef HAVE_FLAC
+#include <FLAC/stream_encoder.h>
+#endif
+#ifdef HAVE_OPUSENC
+#include <opusenc.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 struct AudioOptions {
   int sample_rate = 44100;
+  std::vector<int> sample_rates;     // output rates, rendered once at the highest
   int channels = 2;             // Stereo (will be adjusted to 1 if stereo separation is 0)
   int interpolation_filter = 4; // cubic interpolation (sinc-like)
   int stereo_separation =
       100; // stereo separation in percent [0,200], default 100
   std::string output_format = "wav"; // wav, flac, opus, vorbis
+  std::vector<std::string> output_formats; // all formats written per stem
   int bit_depth = 16;                // for lossless formats
   int opus_bitrate = 128;            // kbps for opus
+  std::string opus_bitrate_mode = "vbr"; // vbr, cvbr (constrained) or cbr
+  int opus_complexity = 10;          // 0-10, lower is cheaper to encode
+  double opus_frame_ms = 20.0;       // 2.5, 5, 10, 20, 40 or 60
   int vorbis_quality = 5;            // 0-10 for vorbis
+  bool peaks = false;                // write waveform overview files
+  int peaks_samples_per_pixel = 256; // finest zoom level
+  int peaks_levels = 1;              // each extra level halves resolution
+  std::string peaks_format = "dat";  // dat (binary) or json
+  int encoder_threads = 0;           // 0 = one per available CPU
+  int flac_compression_level = 5;    // 0-8, as the flac command line tool
+  double flac_seekpoint_spacing = 10.0; // seconds, 0 = no seek table
+  bool flac_md5 = true;              // compute the STREAMINFO MD5 signature
+  bool flac_single_encoder = false;  // one encoder per stem, as a reference
+  bool generic_kernels = false;      // runtime-stride loops, for benchmarks
+  int jobs = 1;                      // render workers, each with a module copy
+  std::string workers_mode = "thread"; // thread or process (forked workers)
+  double max_duration = 0.0; // song seconds rendered per stem, 0 = no limit
+  double timeout = 0.0;      // wall seconds per module, 0 = no limit
+  double stem_timeout = 0.0; // wall seconds per stem, 0 = no limit
+  int prefetch = 2;          // batch modules loaded ahead of the render
+  bool dedupe = true;        // link the stems of duplicate batch modules
+  bool pin_workers = false;          // pin each render worker to one CPU
+  std::vector<int> cpu_list;         // CPUs the process is restricted to
+  int nice = 0;                      // scheduling priority, 0-19
+  bool sched_batch = false;          // SCHED_BATCH for all threads
+  bool info = false;                 // print JSON metadata, no rendering
+  bool list_instruments = false;     // print instrument list, no rendering
+  std::string measure_loudness;      // audio file to measure, no rendering
+  bool minus_one = false;            // also write full mix minus each stem
+  bool group_probe = true;           // probe stems for sound in groups
+  std::string split_by = "instrument"; // instrument, channel, instrument-channel
+  bool huge_pages = false;           // back worker buffers with huge pages
+  size_t max_memory = 0;             // bytes, 0 = no budget
 };
 
-class StemExtractor {
+// Channel count the compile-time specialised kernels are instantiated for,
+// or 0 for the generic runtime-stride instantiation
+inline int kernelChannels(int channels, bool generic) {
+  if (generic || (channels != 1 && channels != 2 && channels != 4)) {
+    return 0;
+  }
+  return channels;
+}
+
+// Render block in planar layout: one contiguous array per channel, each
+// starting on a 64-byte boundary. Analysis runs on the channel arrays with
+// unit stride; writers get an interleaved copy.
+class PlanarBlock {
+public:
+  PlanarBlock(int channels, size_t capacity)
+      : num_channels(channels), capacity(capacity),
+        stride(aligned_stride(capacity)),
+        storage(stride * channels + ALIGN_FLOATS) {
+    uintptr_t address = reinterpret_cast<uintptr_t>(storage.data());
+    uintptr_t aligned = (address + ALIGN_FLOATS * sizeof(float) - 1) &
+                        ~static_cast<uintptr_t>(ALIGN_FLOATS * sizeof(float) - 1);
+    base = reinterpret_cast<float *>(aligned);
+  }
+
+  // Uses caller-owned memory of at least bytes_needed(), 64-byte aligned
+  PlanarBlock(int channels, size_t capacity, float *memory)
+      : num_channels(channels), capacity(capacity),
+        stride(aligned_stride(capacity)), base(memory) {}
+
+  static size_t bytes_needed(int channels, size_t capacity) {
+    return aligned_stride(capacity) * channels * sizeof(float);
+  }
+
+  // Copying would leave base pointing into the source's storage
+  PlanarBlock(const PlanarBlock &) = delete;
+  PlanarBlock &operator=(const PlanarBlock &) = delete;
+
+  int channels() const { return num_channels; }
+  size_t frames_capacity() const { return capacity; }
+  float *channel(int c) { return base + c * stride; }
+  const float *channel(int c) const { return base + c * stride; }
+
 private:
-  std::unique_ptr<openmpt::module_ext> mod;
-  std::string input_path;
-  AudioOptions options;
+  static constexpr size_t ALIGN_FLOATS = 16; // 64 bytes
+
+  static size_t aligned_stride(size_t capacity) {
+    return (capacity + ALIGN_FLOATS - 1) / ALIGN_FLOATS * ALIGN_FLOATS;
+  }
+
+  int num_channels;
+  size_t capacity;
+  size_t stride;
+  std::vector<float> storage;
+  float *base;
+};
+
+// Interleaves the first frames of a block for the writers; Channels is the
+// compile-time channel count, or 0 to use the block's
+template <int Channels>
+void interleaveBlock(const PlanarBlock &block, size_t frames, float *out) {
+  const int n = Channels ? Channels : block.channels();
+  for (int c = 0; c < n; ++c) {
+    const float *in = block.channel(c);
+    for (size_t i = 0; i < frames; ++i) {
+      out[i * n + c] = in[i];
+    }
+  }
+}
+
+// out[i] -= in[i], branch-free so it vectorises
+inline void subtractSamples(float *out, const float *in, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    out[i] -= in[i];
+  }
+}
 
+// Full mix of a module spilled to an anonymous temporary file, so
+// minus-one stems can be built from it without holding it in memory.
+// Once written, it is read with positional reads, which render workers
+// may issue concurrently.
+class MixSpill {
 public:
-  explicit StemExtractor(const std::string &path, const AudioOptions &opts = {})
-      : input_path(path), options(opts) {
-    std::ifstream file(input_path, std::ios::binary);
-    if (!file.is_open()) {
-      throw std::runtime_error("Could not open input file: " + path);
+  explicit MixSpill(int channels)
+      : channels(channels), file(std::tmpfile(), &std::fclose) {
+    if (!file) {
+      throw std::runtime_error("Could not create a temporary file for the "
+                               "full mix");
     }
+  }
 
-    // Load the module using module_ext for advanced features
-    mod = std::make_unique<openmpt::module_ext>(file);
+  bool append(const float *interleaved, size_t frames) {
+    size_t count = frames * channels;
+    if (std::fwrite(interleaved, sizeof(float), count, file.get()) != count) {
+      return false;
+    }
+    total_frames += frames;
+    return true;
+  }
 
-    // Adjust channels based on stereo separation: if 0, use mono
-    AudioOptions adjusted_opts = options;
-    if (adjusted_opts.stereo_separation == 0) {
-      adjusted_opts.channels = 1;  // Mono when stereo separation is 0
+  // Makes the appended frames visible to read()
+  bool flush() { return std::fflush(file.get()) == 0; }
+
+  // Copies frames [first, first + frames); frames past the end of the mix
+  // read as silence
+  bool read(uint64_t first, size_t frames, float *out) {
+    size_t available = first < total_frames
+                           ? static_cast<size_t>(std::min<uint64_t>(
+                                 frames, total_frames - first))
+                           : 0;
+    size_t bytes = available * channels * sizeof(float);
+    off_t offset = static_cast<off_t>(first * channels * sizeof(float));
+    bool ok = true;
+#ifdef __linux__
+    size_t done = 0;
+    while (ok && done < bytes) {
+      ssize_t got = pread(fileno(file.get()),
+                          reinterpret_cast<char *>(out) + done, bytes - done,
+                          offset + static_cast<off_t>(done));
+      ok = got > 0;
+      done += ok ? static_cast<size_t>(got) : 0;
     }
+#else
+    {
+      std::lock_guard<std::mutex> lock(read_mutex);
+      ok = std::fseek(file.get(), static_cast<long>(offset), SEEK_SET) == 0 &&
+           std::fread(out, 1, bytes, file.get()) == bytes;
+    }
+#endif
+    std::fill(out + available * channels, out + frames * channels, 0.0f);
+    return ok;
+  }
 
-    // Set up audio parameters
-    mod->set_render_param(openmpt::module::RENDER_INTERPOLATIONFILTER_LENGTH,
-                          adjusted_opts.interpolation_filter);
-    mod->set_render_param(openmpt::module::RENDER_STEREOSEPARATION_PERCENT,
-                          adjusted_opts.stereo_separation);
-    
-    // Update the stored options with adjusted values
-    const_cast<AudioOptions&>(options) = adjusted_opts;
+  uint64_t frames() const { return total_frames; }
+
+private:
+  int channels;
+  std::unique_ptr<FILE, int (*)(FILE *)> file;
+  uint64_t total_frames = 0;
+#ifndef __linux__
+  std::mutex read_mutex;
+#endif
+};
+
+// Bump allocator for the buffers of one render worker. The worker thread
+// creates and first touches the region, so on NUMA hosts its pages are
+// placed on that worker's node; with huge pages the region is 2 MiB aligned
+// and advised for transparent huge pages, cutting TLB misses on the large
+// render blocks.
+class BufferArena {
+public:
+  BufferArena(size_t bytes, bool huge_pages) {
+    const size_t page = huge_pages ? HUGE_PAGE_SIZE : 4096;
+    size = (bytes + page - 1) / page * page;
+#ifdef __linux__
+    mapped_size = size + (huge_pages ? HUGE_PAGE_SIZE : 0);
+    mapping = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    uintptr_t address = reinterpret_cast<uintptr_t>(mapping);
+    address = (address + page - 1) & ~static_cast<uintptr_t>(page - 1);
+    base = reinterpret_cast<uint8_t *>(address);
+    if (huge_pages) {
+      madvise(base, size, MADV_HUGEPAGE);
+    }
+#else
+    (void)huge_pages;
+    storage.reset(new uint8_t[size + 64]);
+    uintptr_t address = reinterpret_cast<uintptr_t>(storage.get());
+    base = reinterpret_cast<uint8_t *>((address + 63) &
+                                       ~static_cast<uintptr_t>(63));
+#endif
+    std::memset(base, 0, size);
   }
 
-  void extractStems(const std::string &output_dir) {
-    // Get the number of instruments
-    int num_instruments = mod->get_num_instruments();
-    std::cout << "Found " << num_instruments << " instruments." << std::endl;
+  ~BufferArena() {
+#ifdef __linux__
+    munmap(mapping, mapped_size);
+#endif
+  }
 
-    // If no instruments, try using samples instead
-    bool using_samples = false;
-    if (num_instruments == 0) {
-      // Some formats use samples instead of instruments
-      // We'll need to determine the number of samples differently
-      std::cout << "No instruments found, checking for samples..." << std::endl;
+  BufferArena(const BufferArena &) = delete;
+  BufferArena &operator=(const BufferArena &) = delete;
 
-      // For formats like MOD, we should use the number of samples instead
-      int num_samples = mod->get_num_samples();
-      if (num_samples > 0) {
-        num_instruments = num_samples;
-        using_samples = true;
-        std::cout << "Using " << num_instruments
-                  << " samples instead of instruments." << std::endl;
-      } else {
-        // If get_num_samples() doesn't work, try to get it from the module type
-        std::string mod_type = mod->get_metadata("type");
-        if (mod_type.find("MOD") != std::string::npos) {
-          // For MOD files, we'll try to get the number of samples by checking
-          // pattern data This is a more complex approach but should work for
-          // most MOD files We'll try to check if there are samples by looking
-          // at the module structure For now, let's try a different approach -
-          // check if we can get sample info through the interactive interface
-          num_instruments = 31; // Standard MOD files have up to 31 samples
-          using_samples = true;
-          std::cout << "Assuming MOD format with up to " << num_instruments
-                    << " samples." << std::endl;
-        } else {
-          // Fallback to channel count if all else fails
-          num_instruments = mod->get_num_channels();
-          std::cout << "Falling back to " << num_instruments << " channels."
-                    << std::endl;
+  // 64-byte aligned, valid for the lifetime of the arena
+  void *allocate(size_t bytes) {
+    size_t start = (used + 63) & ~static_cast<size_t>(63);
+    if (start + bytes > size) {
+      throw std::bad_alloc();
+    }
+    used = start + bytes;
+    return base + start;
+  }
+
+  size_t capacity() const { return size; }
+
+  // Memory an arena of the given size keeps resident once touched
+  static size_t resident_bytes(size_t bytes, bool huge_pages) {
+    const size_t page = huge_pages ? HUGE_PAGE_SIZE : 4096;
+    return (bytes + page - 1) / page * page;
+  }
+
+  // Room for an allocation of the given size plus its alignment padding
+  static size_t reserve(size_t bytes) { return bytes + 64; }
+
+private:
+  static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+  uint8_t *base = nullptr;
+  size_t size = 0;
+  size_t used = 0;
+#ifdef __linux__
+  void *mapping = nullptr;
+  size_t mapped_size = 0;
+#else
+  std::unique_ptr<uint8_t[]> storage;
+#endif
+};
+
+// CPUs this process may run on, in ascending order
+std::vector<int> allowedCpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  return cpus;
+}
+
+// Restricts the calling thread to one CPU; false where unsupported
+bool pinCurrentThread(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+// CPU limit from a cgroup v2 cpu.max file ("max 100000" or
+// "200000 100000"); 0 when unlimited or unreadable
+double readCgroupCpuMax(const std::string &path) {
+  std::ifstream file(path);
+  std::string quota;
+  double period = 0.0;
+  if (!(file >> quota >> period) || quota == "max" || period <= 0.0) {
+    return 0.0;
+  }
+  return std::atof(quota.c_str()) / period;
+}
+
+// CPU limit from a cgroup v1 CFS quota; 0 when unlimited or unreadable
+double readCfsQuota(const std::string &dir) {
+  std::ifstream quota_file(dir + "/cpu.cfs_quota_us");
+  std::ifstream period_file(dir + "/cpu.cfs_period_us");
+  double quota = 0.0;
+  double period = 0.0;
+  if (!(quota_file >> quota) || !(period_file >> period) || quota <= 0.0 ||
+      period <= 0.0) {
+    return 0.0;
+  }
+  return quota / period;
+}
+
+// CPU time the cgroups of this process may use, in CPUs; 0 when unlimited
+// or not on Linux. Ancestor groups are checked too, as their limits apply
+// to every group below them.
+double cgroupCpuLimit() {
+  double limit = 0.0;
+  auto tighten = [&limit](double value) {
+    if (value > 0.0 && (limit == 0.0 || value < limit)) {
+      limit = value;
+    }
+  };
+#ifdef __linux__
+  std::ifstream cgroups("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(cgroups, line)) {
+    // hierarchy-ID:controllers:path
+    size_t first = line.find(':');
+    size_t second = line.find(':', first + 1);
+    if (first == std::string::npos || second == std::string::npos) {
+      continue;
+    }
+    std::string controllers = line.substr(first + 1, second - first - 1);
+    std::filesystem::path path = line.substr(second + 1);
+    if (controllers.empty()) {
+      // cgroup v2 unified hierarchy
+      while (true) {
+        tighten(readCgroupCpuMax("/sys/fs/cgroup" + path.string() +
+                                 "/cpu.max"));
+        if (path == path.parent_path()) {
+          break;
         }
+        path = path.parent_path();
+      }
+    } else if (("," + controllers + ",").find(",cpu,") != std::string::npos) {
+      // cgroup v1; inside a container the group is mounted as the root
+      for (const char *mount :
+           {"/sys/fs/cgroup/cpu,cpuacct", "/sys/fs/cgroup/cpu"}) {
+        tighten(readCfsQuota(mount + path.string()));
+        tighten(readCfsQuota(mount));
       }
     }
+  }
+#endif
+  return limit;
+}
 
-    std::vector<std::string> names;
+// CPUs worth running threads on: the CPUs in the affinity mask, capped by
+// the cgroup CPU quota rounded up, so containers are not oversubscribed
+unsigned availableCpus() {
+  static const unsigned cpus = [] {
+    unsigned count = static_cast<unsigned>(allowedCpus().size());
+    if (count == 0) {
+      count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    double limit = cgroupCpuLimit();
+    if (limit > 0.0) {
+      count = std::min(count, static_cast<unsigned>(std::ceil(limit)));
+    }
+    return std::max(1u, count);
+  }();
+  return cpus;
+}
 
-    // Get instrument names or sample names depending on the file type
-    if (using_samples) {
-      try {
-        // Use the proper libopenmpt API to get all sample names at once
-        names = mod->get_sample_names();
-      } catch (...) {
-        // If getting sample names fails, initialize with empty strings
-        names.assign(num_instruments, "");
+// Streaming ITU-R BS.1770-4 / EBU R128 loudness and true-peak meter, fed
+// directly from the render buffers so stems never need to be decoded again.
+class LoudnessMeter {
+public:
+  LoudnessMeter(int sample_rate, int channels)
+      : channels(channels), sample_rate(sample_rate),
+        biquad_state(channels * 4, 0.0), channel_weights(channels, 1.0),
+        tp_history(channels * (TP_TAPS - 1), 0.0f), sub_block_energy(channels),
+        sub_block_frames(sample_rate / 10) {
+    // K-weighting pre-filter (high shelf) and RLB high-pass, recomputed for
+    // the output sample rate as in BS.1770-4 Annex 1.
+    double f0 = 1681.974450955533;
+    double gain_db = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = std::tan(M_PI * f0 / sample_rate);
+    double vh = std::pow(10.0, gain_db / 20.0);
+    double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    shelf_b = {(vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0,
+               (vh - vb * k / q + k * k) / a0};
+    shelf_a = {2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = std::tan(M_PI * f0 / sample_rate);
+    a0 = 1.0 + k / q + k * k;
+    highpass_a = {2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+
+    // Quad output is front L/R then rear L/R; surrounds get +1.5 dB
+    if (channels == 4) {
+      channel_weights[2] = channel_weights[3] = 1.41;
+    }
+  }
+
+  // Each channel is filtered over a whole run of frames at a time; runs are
+  // cut at the 100 ms sub-block boundaries where the channels are summed
+  void process(const PlanarBlock &block, int frames) {
+    int done = 0;
+    while (done < frames) {
+      int count = std::min(frames - done, sub_block_frames - sub_block_pos);
+      for (int c = 0; c < channels; ++c) {
+        const float *in = block.channel(c) + done;
+        filter_channel(c, in, count);
+        scan_true_peak(c, in, count);
+      }
+      done += count;
+      sub_block_pos += count;
+      if (sub_block_pos == sub_block_frames) {
+        finish_sub_block();
+      }
+    }
+    frames_processed += frames;
+  }
+
+  uint64_t frames() const { return frames_processed; }
+
+  // Gated integrated loudness in LUFS, -inf for silence or very short input
+  double integrated_lufs() const {
+    double absolute_sum = 0.0;
+    size_t absolute_count = 0;
+    for (double energy : block_energies) {
+      if (energy_to_lufs(energy) > -70.0) {
+        absolute_sum += energy;
+        ++absolute_count;
+      }
+    }
+    if (absolute_count == 0) {
+      return -std::numeric_limits<double>::infinity();
+    }
+
+    double relative_gate = energy_to_lufs(absolute_sum / absolute_count) - 10.0;
+    double gated_sum = 0.0;
+    size_t gated_count = 0;
+    for (double energy : block_energies) {
+      double lufs = energy_to_lufs(energy);
+      if (lufs > -70.0 && lufs > relative_gate) {
+        gated_sum += energy;
+        ++gated_count;
+      }
+    }
+    return gated_count ? energy_to_lufs(gated_sum / gated_count)
+                       : -std::numeric_limits<double>::infinity();
+  }
+
+  double true_peak_dbtp() const { return amplitude_to_db(true_peak); }
+  double sample_peak_dbfs() const { return amplitude_to_db(sample_peak); }
+
+private:
+  // 4x oversampling interpolator from BS.1770-4 Annex 2 (12 taps per phase)
+  static constexpr int TP_TAPS = 12;
+  // Frames interpolated together; the sums of the four phases fit in L1
+  static constexpr int TP_SPAN = 32;
+  static constexpr float TP_COEFFS[4][TP_TAPS] = {
+      {0.0017089843750f, 0.0109863281250f, -0.0196533203125f, 0.0332031250000f,
+       -0.0594482421875f, 0.1373291015625f, 0.9721679687500f, -0.1022949218750f,
+       0.0476074218750f, -0.0266113281250f, 0.0148925781250f, -0.0083007812500f},
+      {-0.0291748046875f, 0.0292968750000f, -0.0517578125000f,
+       0.0891113281250f, -0.1665039062500f, 0.4650878906250f, 0.7797851562500f,
+       -0.2003173828125f, 0.1015625000000f, -0.0582275390625f,
+       0.0330810546875f, -0.0189208984375f},
+      {-0.0189208984375f, 0.0330810546875f, -0.0582275390625f,
+       0.1015625000000f, -0.2003173828125f, 0.7797851562500f, 0.4650878906250f,
+       -0.1665039062500f, 0.0891113281250f, -0.0517578125000f,
+       0.0292968750000f, -0.0291748046875f},
+      {-0.0083007812500f, 0.0148925781250f, -0.0266113281250f,
+       0.0476074218750f, -0.1022949218750f, 0.9721679687500f, 0.1373291015625f,
+       -0.0594482421875f, 0.0332031250000f, -0.0196533203125f,
+       0.0109863281250f, 0.0017089843750f}};
+
+  int channels;
+  int sample_rate;
+  std::array<double, 3> shelf_b;
+  std::array<double, 2> shelf_a;
+  std::array<double, 2> highpass_a;
+  std::vector<double> biquad_state;
+  std::vector<double> channel_weights;
+  std::vector<float> tp_history; // last TP_TAPS - 1 samples per channel
+  std::vector<float> tp_window;  // history followed by the current run
+  std::vector<double> sub_block_energy;
+  int sub_block_frames;
+  int sub_block_pos = 0;
+  std::array<double, 4> recent_sub_blocks{};
+  int sub_blocks_seen = 0;
+  std::vector<double> block_energies;
+  double sample_peak = 0.0;
+  double true_peak = 0.0;
+  uint64_t frames_processed = 0;
+
+  void filter_channel(int c, const float *in, int count) {
+    // Transposed direct form II cascade: shelf then high-pass
+    double *state = &biquad_state[c * 4];
+    double s0 = state[0], s1 = state[1], s2 = state[2], s3 = state[3];
+    double energy = 0.0;
+    float peak = 0.0f;
+    for (int i = 0; i < count; ++i) {
+      double x = in[i];
+      peak = std::max(peak, std::fabs(in[i]));
+      double y1 = shelf_b[0] * x + s0;
+      s0 = shelf_b[1] * x - shelf_a[0] * y1 + s1;
+      s1 = shelf_b[2] * x - shelf_a[1] * y1;
+      double y2 = y1 + s2;
+      s2 = -2.0 * y1 - highpass_a[0] * y2 + s3;
+      s3 = y1 - highpass_a[1] * y2;
+      energy += y2 * y2;
+    }
+    state[0] = s0;
+    state[1] = s1;
+    state[2] = s2;
+    state[3] = s3;
+    sub_block_energy[c] += energy;
+    sample_peak = std::max(sample_peak, static_cast<double>(peak));
+  }
+
+  // TP_SPAN consecutive frames are interpolated at once, all four phases
+  // in one pass over the taps. The loops over frames have a fixed length
+  // and become vector multiply-adds, each input vector loaded once for the
+  // four phases. Each sample still sums its taps in order, as a filter per
+  // sample would, so the peak is the same.
+  void scan_true_peak(int c, const float *in, int count) {
+    float *history = &tp_history[c * (TP_TAPS - 1)];
+    tp_window.resize(TP_TAPS - 1 + count);
+    std::copy(history, history + TP_TAPS - 1, tp_window.begin());
+    std::copy(in, in + count, tp_window.begin() + TP_TAPS - 1);
+
+    float peak[TP_SPAN] = {};
+    int i = 0;
+    for (; i + TP_SPAN <= count; i += TP_SPAN) {
+      const float *newest = &tp_window[i + TP_TAPS - 1];
+      float acc[4][TP_SPAN] = {};
+      for (int k = 0; k < TP_TAPS; ++k) {
+        for (int phase = 0; phase < 4; ++phase) {
+          for (int j = 0; j < TP_SPAN; ++j) {
+            acc[phase][j] += TP_COEFFS[phase][k] * newest[j - k];
+          }
+        }
+      }
+      for (int phase = 0; phase < 4; ++phase) {
+        for (int j = 0; j < TP_SPAN; ++j) {
+          peak[j] = std::max(peak[j], std::fabs(acc[phase][j]));
+        }
+      }
+    }
+    for (; i < count; ++i) {
+      const float *newest = &tp_window[i + TP_TAPS - 1];
+      for (int phase = 0; phase < 4; ++phase) {
+        float acc = 0.0f;
+        for (int k = 0; k < TP_TAPS; ++k) {
+          acc += TP_COEFFS[phase][k] * newest[-k];
+        }
+        peak[0] = std::max(peak[0], std::fabs(acc));
+      }
+    }
+    for (float value : peak) {
+      true_peak = std::max(true_peak, static_cast<double>(value));
+    }
+    std::copy(tp_window.end() - (TP_TAPS - 1), tp_window.end(), history);
+  }
+
+  // Gating blocks are 400 ms long with 75% overlap, so each one is the
+  // mean of the last four 100 ms sub-blocks.
+  void finish_sub_block() {
+    double energy = 0.0;
+    for (int c = 0; c < channels; ++c) {
+      energy += channel_weights[c] * sub_block_energy[c] / sub_block_frames;
+      sub_block_energy[c] = 0.0;
+    }
+    sub_block_pos = 0;
+    recent_sub_blocks[sub_blocks_seen % 4] = energy;
+    if (++sub_blocks_seen >= 4) {
+      block_energies.push_back((recent_sub_blocks[0] + recent_sub_blocks[1] +
+                                recent_sub_blocks[2] + recent_sub_blocks[3]) /
+                               4.0);
+    }
+  }
+
+  static double energy_to_lufs(double energy) {
+    return -0.691 + 10.0 * std::log10(energy);
+  }
+
+  static double amplitude_to_db(double amplitude) {
+    return 20.0 * std::log10(amplitude);
+  }
+};
+
+// Min/max waveform overview computed from the render blocks. Files use the
+// audiowaveform version 2 layout (binary .dat or JSON) understood by web
+// players such as peaks.js; coarser zoom levels are derived by merging
+// pairs of buckets, so only the finest level touches the samples.
+class PeaksBuilder {
+public:
+  PeaksBuilder(int channels, int samples_per_pixel)
+      : channels(channels), samples_per_pixel(samples_per_pixel),
+        bucket_min(channels, 0.0f), bucket_max(channels, 0.0f) {}
+
+  void process(const PlanarBlock &block, int frames) {
+    int done = 0;
+    while (done < frames) {
+      int count = std::min(frames - done, samples_per_pixel - bucket_pos);
+      for (int c = 0; c < channels; ++c) {
+        const float *in = block.channel(c) + done;
+        float lo = bucket_pos ? bucket_min[c] : in[0];
+        float hi = bucket_pos ? bucket_max[c] : in[0];
+        for (int i = 0; i < count; ++i) {
+          lo = std::min(lo, in[i]);
+          hi = std::max(hi, in[i]);
+        }
+        bucket_min[c] = lo;
+        bucket_max[c] = hi;
+      }
+      done += count;
+      bucket_pos += count;
+      if (bucket_pos == samples_per_pixel) {
+        flush_bucket();
+      }
+    }
+  }
+
+  // Writes one file per zoom level: {base_path}.{samples_per_pixel}.{format}
+  bool write(const std::string &base_path, int sample_rate, int levels,
+             const std::string &format) {
+    if (bucket_pos > 0) {
+      flush_bucket();
+    }
+    std::vector<int16_t> level = pixels;
+    int spp = samples_per_pixel;
+    for (int l = 0; l < levels; ++l) {
+      if (l > 0) {
+        level = merge_pairs(level);
+        spp *= 2;
+      }
+      std::string path = base_path + "." + std::to_string(spp) + "." + format;
+      bool ok = (format == "json") ? write_json(path, sample_rate, spp, level)
+                                   : write_dat(path, sample_rate, spp, level);
+      if (!ok) {
+        std::cerr << "Could not write peaks file: " << path << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  int channels;
+  int samples_per_pixel;
+  std::vector<float> bucket_min;
+  std::vector<float> bucket_max;
+  int bucket_pos = 0;
+  std::vector<int16_t> pixels; // per pixel, per channel: min, max
+
+  static int16_t to_int16(float value) {
+    return static_cast<int16_t>(
+        std::lrint(std::max(-1.0f, std::min(1.0f, value)) * 32767.0f));
+  }
+
+  void flush_bucket() {
+    for (int c = 0; c < channels; ++c) {
+      pixels.push_back(to_int16(bucket_min[c]));
+      pixels.push_back(to_int16(bucket_max[c]));
+    }
+    bucket_pos = 0;
+  }
+
+  std::vector<int16_t> merge_pairs(const std::vector<int16_t> &level) const {
+    const size_t stride = 2 * channels;
+    const size_t count = level.size() / stride;
+    std::vector<int16_t> merged;
+    merged.reserve((count + 1) / 2 * stride);
+    for (size_t p = 0; p < count; p += 2) {
+      const int16_t *a = &level[p * stride];
+      const int16_t *b = (p + 1 < count) ? a + stride : a;
+      for (int c = 0; c < channels; ++c) {
+        merged.push_back(std::min(a[2 * c], b[2 * c]));
+        merged.push_back(std::max(a[2 * c + 1], b[2 * c + 1]));
+      }
+    }
+    return merged;
+  }
+
+  bool write_dat(const std::string &path, int sample_rate, int spp,
+                 const std::vector<int16_t> &level) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+      return false;
+    }
+    auto put32 = [&out](uint32_t value) {
+      char bytes[4] = {static_cast<char>(value), static_cast<char>(value >> 8),
+                       static_cast<char>(value >> 16),
+                       static_cast<char>(value >> 24)};
+      out.write(bytes, 4);
+    };
+    put32(2); // version
+    put32(0); // flags: 16-bit values
+    put32(sample_rate);
+    put32(spp);
+    put32(static_cast<uint32_t>(level.size() / (2 * channels)));
+    put32(channels);
+    for (int16_t value : level) {
+      char bytes[2] = {static_cast<char>(value & 0xff),
+                       static_cast<char>((value >> 8) & 0xff)};
+      out.write(bytes, 2);
+    }
+    return static_cast<bool>(out);
+  }
+
+  bool write_json(const std::string &path, int sample_rate, int spp,
+                  const std::vector<int16_t> &level) const {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+      return false;
+    }
+    out << "{\"version\":2,\"channels\":" << channels
+        << ",\"sample_rate\":" << sample_rate
+        << ",\"samples_per_pixel\":" << spp << ",\"bits\":16,\"length\":"
+        << level.size() / (2 * channels) << ",\"data\":[";
+    for (size_t i = 0; i < level.size(); ++i) {
+      out << (i ? "," : "") << level[i];
+    }
+    out << "]}\n";
+    return static_cast<bool>(out);
+  }
+};
+
+// Float to integer PCM conversion, instantiated per output sample type so
+// the scale is a constant and the loop vectorises. Samples are clipped to
+// [-1, 1] and scaled to Bits bits, then moved up by Shift bits for APIs
+// that expect left-justified samples.
+template <typename T, int Bits, int Shift = 0>
+void convertSamples(const float *in, T *out, size_t count) {
+  using Scale = typename std::conditional<(Bits > 24), double, float>::type;
+  constexpr Scale scale =
+      static_cast<Scale>((static_cast<int64_t>(1) << (Bits - 1)) - 1);
+  constexpr T shift_factor = static_cast<T>(1) << Shift;
+  for (size_t i = 0; i < count; ++i) {
+    Scale x = std::max<Scale>(-1, std::min<Scale>(1, in[i]));
+    out[i] = static_cast<T>(std::lrint(x * scale)) * shift_factor;
+  }
+}
+
+// Packs samples as little-endian Bytes-byte words, the layout the FLAC MD5
+// signature is computed over
+template <int Bytes>
+void packLittleEndian(const int32_t *in, uint8_t *out, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    for (int b = 0; b < Bytes; ++b) {
+      out[i * Bytes + b] = static_cast<uint8_t>(in[i] >> (8 * b));
+    }
+  }
+}
+
+// Encoder back end for one output file of a stem
+class StemWriter {
+public:
+  virtual ~StemWriter() = default;
+  virtual bool write(const float *interleaved, int frames) = 0;
+  // Flushes and closes the file; returns false if anything failed
+  virtual bool finish() = 0;
+};
+
+class SndfileWriter : public StemWriter {
+public:
+  static std::unique_ptr<SndfileWriter> open(const std::string &path,
+                                             const AudioOptions &options) {
+    SF_INFO sf_info = {};
+    sf_info.samplerate = options.sample_rate;
+    sf_info.channels = options.channels;
+
+    // Set format based on user selection. WAV with more than two channels
+    // must be WAVE_FORMAT_EXTENSIBLE to carry a speaker mask
+    if (options.output_format == "wav") {
+      sf_info.format =
+          (options.channels > 2 ? SF_FORMAT_WAVEX : SF_FORMAT_WAV) |
+          (options.bit_depth == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_24);
+    } else if (options.output_format == "flac") {
+      sf_info.format =
+          SF_FORMAT_FLAC |
+          (options.bit_depth == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_24);
+    } else if (options.output_format == "vorbis") {
+      sf_info.format = SF_FORMAT_OGG | SF_FORMAT_VORBIS;
+    } else if (options.output_format == "opus") {
+      sf_info.format = SF_FORMAT_OGG | SF_FORMAT_OPUS;
+    } else {
+      // Default to WAV if format is not recognized
+      sf_info.format =
+          SF_FORMAT_WAV |
+          (options.bit_depth == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_24);
+      std::cout << "Unknown format '" << options.output_format
+                << "', defaulting to WAV." << std::endl;
+    }
+
+    SNDFILE *outfile = sf_open(path.c_str(), SFM_WRITE, &sf_info);
+    if (!outfile) {
+      std::cerr << "Could not create output file: " << path << " - "
+                << sf_strerror(nullptr) << std::endl;
+      return nullptr;
+    }
+
+    // libopenmpt renders quad as front left/right then rear left/right,
+    // which WAVEX stores as the KSAUDIO_SPEAKER_QUAD mask (0x33). libsndfile
+    // only maps the plain LEFT/RIGHT ids to the front speaker bits.
+    if (options.channels == 4 && options.output_format == "wav") {
+      int channel_map[4] = {SF_CHANNEL_MAP_LEFT, SF_CHANNEL_MAP_RIGHT,
+                            SF_CHANNEL_MAP_REAR_LEFT, SF_CHANNEL_MAP_REAR_RIGHT};
+      if (sf_command(outfile, SFC_SET_CHANNEL_MAP_INFO, channel_map,
+                     sizeof(channel_map)) != SF_TRUE) {
+        std::cerr << "Warning: Could not set quad channel layout: "
+                  << sf_strerror(outfile) << std::endl;
+      }
+    }
+
+    // Encoder settings must be applied before the first write, when
+    // libsndfile emits the stream headers
+    if (options.output_format == "flac") {
+      // libsndfile maps [0, 1] onto the libFLAC compression levels 0-8
+      double level = options.flac_compression_level / 8.0;
+      sf_command(outfile, SFC_SET_COMPRESSION_LEVEL, &level, sizeof(level));
+    } else if (options.output_format == "vorbis") {
+      // Vorbis VBR quality is 1 - compression level
+      double level = 1.0 - options.vorbis_quality / 10.0;
+      if (sf_command(outfile, SFC_SET_COMPRESSION_LEVEL, &level,
+                     sizeof(level)) != SF_TRUE) {
+        std::cerr << "Warning: Could not set Vorbis quality: "
+                  << sf_strerror(outfile) << std::endl;
+      }
+    } else if (options.output_format == "opus") {
+      double level = opus_compression_level(options.opus_bitrate,
+                                            options.channels);
+      if (sf_command(outfile, SFC_SET_COMPRESSION_LEVEL, &level,
+                     sizeof(level)) != SF_TRUE) {
+        std::cerr << "Warning: Could not set Opus bitrate: "
+                  << sf_strerror(outfile) << std::endl;
+      }
+    }
+    std::unique_ptr<SndfileWriter> writer(
+        new SndfileWriter(outfile, options.channels));
+    // PCM is converted here with clipping; lossy encoders take float
+    int subtype = sf_info.format & SF_FORMAT_SUBMASK;
+    if (!options.generic_kernels && subtype == SF_FORMAT_PCM_16) {
+      writer->write_block = &SndfileWriter::write_pcm16;
+    } else if (!options.generic_kernels && subtype == SF_FORMAT_PCM_24) {
+      writer->write_block = &SndfileWriter::write_pcm24;
+    }
+    return writer;
+  }
+
+  ~SndfileWriter() override {
+    if (outfile) {
+      sf_close(outfile);
+    }
+  }
+
+  bool write(const float *interleaved, int frames) override {
+    sf_count_t frames_written = (this->*write_block)(interleaved, frames);
+    if (frames_written != frames) {
+      std::cerr << "Error writing to output file: " << sf_strerror(outfile)
+                << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool finish() override {
+    int result = sf_close(outfile);
+    outfile = nullptr;
+    return result == 0;
+  }
+
+private:
+  SNDFILE *outfile;
+  int channels;
+  sf_count_t (SndfileWriter::*write_block)(const float *, int) =
+      &SndfileWriter::write_float;
+  std::vector<int16_t> pcm16;
+  std::vector<int> pcm32;
+
+  SndfileWriter(SNDFILE *outfile, int channels)
+      : outfile(outfile), channels(channels) {}
+
+  sf_count_t write_float(const float *interleaved, int frames) {
+    return sf_writef_float(outfile, interleaved, frames);
+  }
+
+  sf_count_t write_pcm16(const float *interleaved, int frames) {
+    pcm16.resize(static_cast<size_t>(frames) * channels);
+    convertSamples<int16_t, 16>(interleaved, pcm16.data(), pcm16.size());
+    return sf_writef_short(outfile, pcm16.data(), frames);
+  }
+
+  // libsndfile keeps the top 24 bits of int samples
+  sf_count_t write_pcm24(const float *interleaved, int frames) {
+    pcm32.resize(static_cast<size_t>(frames) * channels);
+    convertSamples<int, 24, 8>(interleaved, pcm32.data(), pcm32.size());
+    return sf_writef_int(outfile, pcm32.data(), frames);
+  }
+
+  // libsndfile has no direct bitrate control for Opus: the compression level
+  // is mapped linearly from 256 kbps (level 0) down to 6 kbps per channel.
+  static double opus_compression_level(int bitrate_kbps, int channels) {
+    double max_kbps = 256.0 * channels;
+    double min_kbps = 6.0 * channels;
+    double level = (max_kbps - bitrate_kbps) / (max_kbps - min_kbps);
+    return std::max(0.0, std::min(1.0, level));
+  }
+};
+
+#ifdef HAVE_FLAC
+// RFC 1321 MD5, used for the FLAC STREAMINFO audio signature
+class Md5 {
+public:
+  void update(const uint8_t *data, size_t size) {
+    total_size += size;
+    while (size > 0) {
+      size_t take = std::min(size, sizeof(block) - block_size);
+      std::memcpy(block + block_size, data, take);
+      block_size += take;
+      data += take;
+      size -= take;
+      if (block_size == sizeof(block)) {
+        transform(block);
+        block_size = 0;
+      }
+    }
+  }
+
+  std::array<uint8_t, 16> digest() {
+    uint64_t bit_count = total_size * 8;
+    uint8_t padding[72] = {0x80};
+    size_t pad_size = (block_size < 56) ? 56 - block_size : 120 - block_size;
+    update(padding, pad_size);
+    uint8_t length[8];
+    for (int i = 0; i < 8; ++i) {
+      length[i] = static_cast<uint8_t>(bit_count >> (8 * i));
+    }
+    update(length, 8);
+    std::array<uint8_t, 16> result;
+    for (int i = 0; i < 16; ++i) {
+      result[i] = static_cast<uint8_t>(state[i / 4] >> (8 * (i % 4)));
+    }
+    return result;
+  }
+
+private:
+  uint32_t state[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+  uint8_t block[64];
+  size_t block_size = 0;
+  uint64_t total_size = 0;
+
+  static uint32_t rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+  void transform(const uint8_t *data) {
+    static const uint32_t K[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+        0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+        0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+        0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+        0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+        0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+        0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+        0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+        0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+    static const int R[64] = {7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7,
+                              12, 17, 22, 5, 9,  14, 20, 5, 9,  14, 20, 5, 9,
+                              14, 20, 5, 9,  14, 20, 4, 11, 16, 23, 4, 11, 16,
+                              23, 4, 11, 16, 23, 4, 11, 16, 23, 6, 10, 15, 21,
+                              6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+    uint32_t m[16];
+    for (int i = 0; i < 16; ++i) {
+      m[i] = data[i * 4] | (data[i * 4 + 1] << 8) | (data[i * 4 + 2] << 16) |
+             (static_cast<uint32_t>(data[i * 4 + 3]) << 24);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; ++i) {
+      uint32_t f;
+      int g;
+      if (i < 16) {
+        f = (b & c) | (~b & d);
+        g = i;
+      } else if (i < 32) {
+        f = (d & b) | (~d & c);
+        g = (5 * i + 1) % 16;
+      } else if (i < 48) {
+        f = b ^ c ^ d;
+        g = (3 * i + 5) % 16;
+      } else {
+        f = c ^ (b | ~d);
+        g = (7 * i) % 16;
+      }
+      uint32_t next = d;
+      d = c;
+      c = b;
+      b = b + rotl(a + f + K[i] + m[g], R[i]);
+      a = next;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+  }
+};
+
+// FLAC writer that encodes runs of whole frames in parallel with independent
+// libFLAC encoders on a fixed set of encoder threads, then renumbers the
+// frame headers and concatenates the runs into one stream. Every encoder
+// uses the same fixed block size and no inter-frame state (loose mid/side
+// is disabled), so the output is bit-exact with one encoder over the whole
+// stream, which --flac-single-encoder keeps as the reference. STREAMINFO
+// and SEEKTABLE are written up front as placeholders and rewritten once
+// the stream is done.
+class FlacWriter : public StemWriter {
+public:
+  static std::unique_ptr<FlacWriter> open(const std::string &path,
+                                          const AudioOptions &options,
+                                          uint64_t estimated_frames) {
+    std::unique_ptr<FlacWriter> writer(new FlacWriter(options));
+    writer->out.open(path, std::ios::binary | std::ios::trunc);
+    if (!writer->out.is_open()) {
+      std::cerr << "Could not create output file: " << path << std::endl;
+      return nullptr;
+    }
+
+    // Reserve one seek point per spacing interval of the expected length;
+    // unused slots stay placeholder points, which decoders ignore.
+    uint64_t spacing = writer->seekpoint_spacing_frames();
+    if (spacing > 0) {
+      writer->reserved_seekpoints =
+          static_cast<size_t>(estimated_frames / spacing + 2);
+    }
+    writer->write_metadata();
+    return writer;
+  }
+
+  // Most memory one writer holds: the chunk being filled and every chunk in
+  // flight, as samples and as encoded bytes
+  static size_t buffer_bytes(const AudioOptions &options) {
+    size_t samples =
+        static_cast<size_t>(blocksize_for(options.flac_compression_level)) *
+        FRAMES_PER_CHUNK * options.channels;
+    return (encoder_threads(options) + 1) * samples *
+           (sizeof(int32_t) + options.bit_depth / 8);
+  }
+
+  ~FlacWriter() override {
+    if (serial_encoder) {
+      FLAC__stream_encoder_delete(serial_encoder);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closing = true;
+      queued.clear(); // runs not yet started are never written
+    }
+    changed.notify_all();
+    for (std::thread &encoder : encoders) {
+      encoder.join();
+    }
+  }
+
+  bool write(const float *interleaved, int frames) override {
+    if (generic) {
+      return write_generic(interleaved, frames);
+    }
+    // Whole blocks go through the conversion and packing kernels picked
+    // for the bit depth, split only at chunk boundaries
+    size_t remaining = static_cast<size_t>(frames) * channels;
+    while (remaining > 0) {
+      size_t start = pending.size();
+      size_t count = std::min(remaining, chunk_frames() * channels - start);
+      pending.resize(start + count);
+      convert(interleaved, &pending[start], count);
+      if (do_md5) {
+        md5_bytes.resize(count * (bits_per_sample / 8));
+        pack(&pending[start], md5_bytes.data(), count);
+        md5.update(md5_bytes.data(), md5_bytes.size());
+      }
+      interleaved += count;
+      remaining -= count;
+      if (pending.size() == chunk_frames() * channels) {
+        if (!submit_chunk()) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  bool finish() override {
+    bool ok = true;
+    if (!pending.empty()) {
+      ok = submit_chunk();
+    }
+    if (ok && serial_encoder) {
+      ok = FLAC__stream_encoder_finish(serial_encoder) &&
+           write_serial_output();
+    }
+    while (ok && !in_flight.empty()) {
+      ok = write_next_chunk();
+    }
+    if (!ok) {
+      return false;
+    }
+    out.seekp(0);
+    write_metadata();
+    out.close();
+    return !out.fail();
+  }
+
+private:
+  // Frames per parallel run; large enough that encoder setup is negligible
+  static constexpr uint32_t FRAMES_PER_CHUNK = 64;
+  static constexpr uint32_t SEEKPOINT_SIZE = 18;
+
+  struct EncodedChunk {
+    bool ok = false;
+    std::vector<uint8_t> bytes;
+    std::vector<uint32_t> frame_sizes;
+    std::vector<uint32_t> frame_samples;
+  };
+
+  // A run of frames from submission until it is written, in stream order
+  struct ChunkJob {
+    std::vector<int32_t> samples;
+    uint64_t first_frame;
+    EncodedChunk encoded;
+    bool done = false;
+  };
+
+  struct SeekPoint {
+    uint64_t sample;
+    uint64_t offset;
+    uint32_t frame_samples;
+  };
+
+  std::ofstream out;
+  int sample_rate;
+  int channels;
+  int bits_per_sample;
+  int compression_level;
+  uint32_t blocksize;
+  double seekpoint_spacing; // seconds, 0 = no seek table
+  bool do_md5;
+  size_t max_in_flight;
+  bool single_encoder;
+
+  bool generic;
+  void (*convert)(const float *, int32_t *, size_t);
+  void (*pack)(const int32_t *, uint8_t *, size_t);
+  std::vector<uint8_t> md5_bytes;
+
+  std::vector<int32_t> pending;
+  uint64_t next_frame_number = 0;
+  // Jobs in stream order; the encoder threads take them from queued
+  std::deque<std::unique_ptr<ChunkJob>> in_flight;
+  std::deque<ChunkJob *> queued;
+  std::vector<std::thread> encoders;
+  std::mutex mutex;
+  std::condition_variable changed;
+  bool closing = false;
+  Md5 md5;
+
+  // --flac-single-encoder: one encoder fed chunk by chunk, frames written
+  // as it emits them
+  FLAC__StreamEncoder *serial_encoder = nullptr;
+  EncodedChunk serial_output;
+
+  uint64_t stream_bytes = 0;
+  uint64_t stream_samples = 0;
+  uint32_t min_frame_size = 0;
+  uint32_t max_frame_size = 0;
+  size_t reserved_seekpoints = 0;
+  std::vector<SeekPoint> seekpoints;
+  std::array<uint8_t, 16> md5_digest{};
+
+  explicit FlacWriter(const AudioOptions &options)
+      : sample_rate(options.sample_rate), channels(options.channels),
+        bits_per_sample(options.bit_depth),
+        compression_level(options.flac_compression_level),
+        blocksize(blocksize_for(options.flac_compression_level)),
+        seekpoint_spacing(options.flac_seekpoint_spacing),
+        do_md5(options.flac_md5),
+        single_encoder(options.flac_single_encoder),
+        generic(options.generic_kernels),
+        convert(options.bit_depth == 16 ? &convertSamples<int32_t, 16>
+                                        : &convertSamples<int32_t, 24>),
+        pack(options.bit_depth == 16 ? &packLittleEndian<2>
+                                     : &packLittleEndian<3>) {
+    max_in_flight = encoder_threads(options);
+    pending.reserve(chunk_frames() * channels);
+  }
+
+  // Same block sizes libFLAC picks for each compression level
+  static uint32_t blocksize_for(int compression_level) {
+    return compression_level <= 2 ? 1152 : 4096;
+  }
+
+  static unsigned encoder_threads(const AudioOptions &options) {
+    return options.encoder_threads > 0 ? options.encoder_threads
+                                       : availableCpus();
+  }
+
+  // Per-sample conversion with the bit depth read at run time; kept as the
+  // reference path for --generic-kernels
+  bool write_generic(const float *interleaved, int frames) {
+    const float scale = static_cast<float>((1 << (bits_per_sample - 1)) - 1);
+    const int bytes_per_sample = bits_per_sample / 8;
+    uint8_t le[4 * 4];
+    for (int frame = 0; frame < frames; ++frame) {
+      for (int c = 0; c < channels; ++c) {
+        float x = std::max(-1.0f, std::min(1.0f, interleaved[frame * channels + c]));
+        int32_t sample = static_cast<int32_t>(std::lrint(x * scale));
+        pending.push_back(sample);
+        for (int b = 0; b < bytes_per_sample; ++b) {
+          le[c * bytes_per_sample + b] = static_cast<uint8_t>(sample >> (8 * b));
+        }
+      }
+      if (do_md5) {
+        md5.update(le, channels * bytes_per_sample);
+      }
+      if (pending.size() == chunk_frames() * channels) {
+        if (!submit_chunk()) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  size_t chunk_frames() const {
+    return static_cast<size_t>(blocksize) * FRAMES_PER_CHUNK;
+  }
+
+  uint64_t seekpoint_spacing_frames() const {
+    if (seekpoint_spacing <= 0.0) {
+      return 0;
+    }
+    return std::max<uint64_t>(
+        blocksize, static_cast<uint64_t>(seekpoint_spacing * sample_rate));
+  }
+
+  bool submit_chunk() {
+    if (single_encoder) {
+      return submit_serial();
+    }
+    if (in_flight.size() >= max_in_flight && !write_next_chunk()) {
+      return false;
+    }
+    auto job = std::make_unique<ChunkJob>();
+    job->first_frame = next_frame_number;
+    size_t frames = pending.size() / channels;
+    next_frame_number += (frames + blocksize - 1) / blocksize;
+    job->samples = std::move(pending);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queued.push_back(job.get());
+      in_flight.push_back(std::move(job));
+    }
+    // Encoder threads are started as chunks come, up to one per chunk in
+    // flight, so a short stem does not start the whole set
+    if (encoders.size() < max_in_flight &&
+        encoders.size() < in_flight.size()) {
+      encoders.emplace_back(&FlacWriter::run_encoder, this);
+    } else {
+      changed.notify_all();
+    }
+    pending = std::vector<int32_t>();
+    pending.reserve(chunk_frames() * channels);
+    return true;
+  }
+
+  void run_encoder() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      changed.wait(lock, [this] { return closing || !queued.empty(); });
+      if (queued.empty()) {
+        return; // closing and drained
+      }
+      ChunkJob *job = queued.front();
+      queued.pop_front();
+      lock.unlock();
+      EncodedChunk encoded = encode_chunk(job->samples, job->first_frame);
+      job->samples = std::vector<int32_t>();
+      lock.lock();
+      job->encoded = std::move(encoded);
+      job->done = true;
+      changed.notify_all();
+    }
+  }
+
+  // Feeds the chunk to the one encoder of the stream and writes the frames
+  // it has finished, which carry their final frame numbers already
+  bool submit_serial() {
+    if (!serial_encoder) {
+      serial_encoder = start_encoder(&serial_output);
+      if (!serial_encoder) {
+        std::cerr << "FLAC encoding failed" << std::endl;
+        return false;
+      }
+    }
+    if (!FLAC__stream_encoder_process_interleaved(
+            serial_encoder, pending.data(),
+            static_cast<uint32_t>(pending.size() / channels)) ||
+        !write_serial_output()) {
+      return false;
+    }
+    pending.clear();
+    return true;
+  }
+
+  bool write_serial_output() {
+    bool ok = write_encoded(serial_output);
+    serial_output = EncodedChunk();
+    return ok;
+  }
+
+  // A new encoder with this stream's settings, initialized to append its
+  // frames to target; nullptr if libFLAC refuses the settings
+  FLAC__StreamEncoder *start_encoder(EncodedChunk *target) const {
+    FLAC__StreamEncoder *encoder = FLAC__stream_encoder_new();
+    if (!encoder) {
+      return nullptr;
+    }
+    FLAC__stream_encoder_set_channels(encoder, channels);
+    FLAC__stream_encoder_set_bits_per_sample(encoder, bits_per_sample);
+    FLAC__stream_encoder_set_sample_rate(encoder, sample_rate);
+    FLAC__stream_encoder_set_compression_level(encoder, compression_level);
+    FLAC__stream_encoder_set_blocksize(encoder, blocksize);
+    FLAC__stream_encoder_set_loose_mid_side_stereo(encoder, false);
+    FLAC__stream_encoder_set_do_md5(encoder, false);
+
+    auto on_write = [](const FLAC__StreamEncoder *, const FLAC__byte buffer[],
+                       size_t bytes, uint32_t samples, uint32_t,
+                       void *client) -> FLAC__StreamEncoderWriteStatus {
+      // samples == 0 means stream header or metadata, which we write ourselves
+      if (samples > 0) {
+        auto *target = static_cast<EncodedChunk *>(client);
+        target->bytes.insert(target->bytes.end(), buffer, buffer + bytes);
+        target->frame_sizes.push_back(static_cast<uint32_t>(bytes));
+        target->frame_samples.push_back(samples);
+      }
+      return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+    };
+
+    if (FLAC__stream_encoder_init_stream(encoder, on_write, nullptr, nullptr,
+                                         nullptr, target) !=
+        FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+      FLAC__stream_encoder_delete(encoder);
+      return nullptr;
+    }
+    return encoder;
+  }
+
+  EncodedChunk encode_chunk(const std::vector<int32_t> &samples,
+                            uint64_t first_frame) const {
+    EncodedChunk chunk;
+    FLAC__StreamEncoder *encoder = start_encoder(&chunk);
+    if (!encoder) {
+      return chunk;
+    }
+    chunk.ok = FLAC__stream_encoder_process_interleaved(
+        encoder, samples.data(),
+        static_cast<uint32_t>(samples.size() / channels));
+    chunk.ok = FLAC__stream_encoder_finish(encoder) && chunk.ok;
+    FLAC__stream_encoder_delete(encoder);
+
+    if (chunk.ok) {
+      chunk.ok = renumber_frames(chunk, first_frame);
+    }
+    return chunk;
+  }
+
+  bool write_next_chunk() {
+    EncodedChunk chunk;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [this] { return in_flight.front()->done; });
+      chunk = std::move(in_flight.front()->encoded);
+      in_flight.pop_front();
+    }
+    if (!chunk.ok) {
+      std::cerr << "FLAC encoding failed" << std::endl;
+      return false;
+    }
+    return write_encoded(chunk);
+  }
+
+  // Appends encoded frames to the file and to the STREAMINFO and seek table
+  // bookkeeping
+  bool write_encoded(const EncodedChunk &chunk) {
+    uint64_t spacing = seekpoint_spacing_frames();
+    for (size_t i = 0; i < chunk.frame_sizes.size(); ++i) {
+      uint32_t size = chunk.frame_sizes[i];
+      if (spacing > 0 && (seekpoints.empty() || stream_samples / spacing !=
+                                                    seekpoints.back().sample / spacing)) {
+        seekpoints.push_back({stream_samples, stream_bytes, chunk.frame_samples[i]});
+      }
+      min_frame_size = min_frame_size ? std::min(min_frame_size, size) : size;
+      max_frame_size = std::max(max_frame_size, size);
+      stream_bytes += size;
+      stream_samples += chunk.frame_samples[i];
+    }
+    out.write(reinterpret_cast<const char *>(chunk.bytes.data()),
+              chunk.bytes.size());
+    if (!out) {
+      std::cerr << "Error writing to FLAC output file" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Each chunk encoder numbers its frames from zero. Rewrite the coded frame
+  // number in every header, then refresh the header CRC-8 and frame CRC-16.
+  static bool renumber_frames(EncodedChunk &chunk, uint64_t first_frame) {
+    std::vector<uint8_t> renumbered;
+    renumbered.reserve(chunk.bytes.size() + chunk.frame_sizes.size() * 4);
+    size_t offset = 0;
+    for (size_t i = 0; i < chunk.frame_sizes.size(); ++i) {
+      const uint8_t *frame = chunk.bytes.data() + offset;
+      uint32_t size = chunk.frame_sizes[i];
+      offset += size;
+
+      size_t number_length = coded_number_length(frame[4]);
+      size_t tail = 4 + number_length;
+      int blocksize_code = frame[2] >> 4;
+      int rate_code = frame[2] & 0x0f;
+      tail += (blocksize_code == 6) ? 1 : (blocksize_code == 7) ? 2 : 0;
+      tail += (rate_code == 12) ? 1 : (rate_code == 13 || rate_code == 14) ? 2 : 0;
+      if (number_length == 0 || size < tail + 3) {
+        return false;
+      }
+
+      size_t start = renumbered.size();
+      renumbered.insert(renumbered.end(), frame, frame + 4);
+      append_coded_number(renumbered, first_frame + i);
+      renumbered.insert(renumbered.end(), frame + 4 + number_length,
+                        frame + tail);
+      renumbered.push_back(crc8(&renumbered[start], renumbered.size() - start));
+      // Subframes and padding are unchanged; skip the old CRC-8 and CRC-16
+      renumbered.insert(renumbered.end(), frame + tail + 1, frame + size - 2);
+      uint16_t crc = crc16(&renumbered[start], renumbered.size() - start);
+      renumbered.push_back(static_cast<uint8_t>(crc >> 8));
+      renumbered.push_back(static_cast<uint8_t>(crc));
+      chunk.frame_sizes[i] = static_cast<uint32_t>(renumbered.size() - start);
+    }
+    chunk.bytes.swap(renumbered);
+    return true;
+  }
+
+  static size_t coded_number_length(uint8_t first) {
+    if (first < 0x80) return 1;
+    if ((first & 0xe0) == 0xc0) return 2;
+    if ((first & 0xf0) == 0xe0) return 3;
+    if ((first & 0xf8) == 0xf0) return 4;
+    if ((first & 0xfc) == 0xf8) return 5;
+    if ((first & 0xfe) == 0xfc) return 6;
+    return 0;
+  }
+
+  // UTF-8 style variable length coding used for FLAC frame numbers
+  static void append_coded_number(std::vector<uint8_t> &out, uint64_t value) {
+    if (value < 0x80) {
+      out.push_back(static_cast<uint8_t>(value));
+      return;
+    }
+    int length = value < 0x800 ? 2 : value < 0x10000 ? 3 : value < 0x200000 ? 4
+               : value < 0x4000000 ? 5 : 6;
+    uint8_t lead_mask = static_cast<uint8_t>(0xff00 >> length);
+    out.push_back(static_cast<uint8_t>(lead_mask | (value >> (6 * (length - 1)))));
+    for (int i = length - 2; i >= 0; --i) {
+      out.push_back(static_cast<uint8_t>(0x80 | ((value >> (6 * i)) & 0x3f)));
+    }
+  }
+
+  static uint8_t crc8(const uint8_t *data, size_t size) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < size; ++i) {
+      crc ^= data[i];
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07)
+                           : static_cast<uint8_t>(crc << 1);
+      }
+    }
+    return crc;
+  }
+
+  static uint16_t crc16(const uint8_t *data, size_t size) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < size; ++i) {
+      crc ^= static_cast<uint16_t>(data[i] << 8);
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x8005)
+                             : static_cast<uint16_t>(crc << 1);
+      }
+    }
+    return crc;
+  }
+
+  // Writes "fLaC", STREAMINFO and SEEKTABLE from the current state
+  void write_metadata() {
+    std::vector<uint8_t> header = {'f', 'L', 'a', 'C'};
+    auto put = [&header](uint64_t value, int bytes) {
+      for (int i = bytes - 1; i >= 0; --i) {
+        header.push_back(static_cast<uint8_t>(value >> (8 * i)));
+      }
+    };
+
+    // STREAMINFO is the last metadata block when there is no seek table
+    put(reserved_seekpoints > 0 ? 0x00 : 0x80, 1);
+    put(34, 3);
+    put(blocksize, 2);
+    put(blocksize, 2);
+    put(min_frame_size, 3);
+    put(max_frame_size, 3);
+    put((static_cast<uint64_t>(sample_rate) << 44) |
+            (static_cast<uint64_t>(channels - 1) << 41) |
+            (static_cast<uint64_t>(bits_per_sample - 1) << 36) |
+            (stream_samples & 0xfffffffffULL),
+        8);
+    // An all-zero signature means "not computed"
+    if (do_md5 && stream_samples > 0) {
+      md5_digest = md5.digest();
+    }
+    header.insert(header.end(), md5_digest.begin(), md5_digest.end());
+
+    if (reserved_seekpoints == 0) {
+      out.write(reinterpret_cast<const char *>(header.data()), header.size());
+      return;
+    }
+    put(0x80 | 0x03, 1); // SEEKTABLE, last metadata block
+    put(reserved_seekpoints * SEEKPOINT_SIZE, 3);
+    for (size_t i = 0; i < reserved_seekpoints; ++i) {
+      // Thin out evenly if the stream ran longer than estimated
+      if (i < seekpoints.size()) {
+        const SeekPoint &point =
+            seekpoints.size() <= reserved_seekpoints
+                ? seekpoints[i]
+                : seekpoints[i * seekpoints.size() / reserved_seekpoints];
+        put(point.sample, 8);
+        put(point.offset, 8);
+        put(point.frame_samples, 2);
+      } else {
+        put(0xffffffffffffffffULL, 8); // placeholder
+        put(0, 8);
+        put(0, 2);
+      }
+    }
+    out.write(reinterpret_cast<const char *>(header.data()), header.size());
+  }
+};
+#endif
+
+// Opus only codes a few rates; other rates are resampled to 48 kHz,
+// which is what decoders play back anyway
+int opusSampleRate(int rate) {
+  return rate == 8000 || rate == 12000 || rate == 16000 || rate == 24000
+             ? rate
+             : 48000;
+}
+
+// Whether Opus at rates[i] would be resampled to a rate the same Opus
+// stems are already written at: one of the other requested rates, or the
+// rate an earlier entry is resampled to
+bool opusRepeatsRate(const std::vector<int> &rates, size_t i) {
+  int coded = opusSampleRate(rates[i]);
+  if (coded == rates[i]) {
+    return false;
+  }
+  if (std::find(rates.begin(), rates.end(), coded) != rates.end()) {
+    return true;
+  }
+  for (size_t j = 0; j < i; ++j) {
+    if (opusSampleRate(rates[j]) == coded) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef HAVE_OPUSENC
+// Native Ogg Opus writer through libopusenc, which takes care of pre-skip,
+// granule positions and resampling to the 48 kHz Opus clock.
+class OpusWriter : public StemWriter {
+public:
+  static std::unique_ptr<OpusWriter> open(const std::string &path,
+                                          const AudioOptions &options) {
+    OggOpusComments *comments = ope_comments_create();
+    if (!comments) {
+      std::cerr << "Could not create Opus comments" << std::endl;
+      return nullptr;
+    }
+    ope_comments_add(comments, "ENCODER", "untracker");
+
+    // Mapping family 1 carries the front/rear layout of quad output
+    int family = options.channels > 2 ? 1 : 0;
+    int error = OPE_OK;
+    OggOpusEnc *encoder =
+        ope_encoder_create_file(path.c_str(), comments, options.sample_rate,
+                                options.channels, family, &error);
+    ope_comments_destroy(comments);
+    if (!encoder) {
+      std::cerr << "Could not create output file: " << path << " - "
+                << ope_strerror(error) << std::endl;
+      return nullptr;
+    }
+
+    bool vbr = options.opus_bitrate_mode != "cbr";
+    bool constrained = options.opus_bitrate_mode == "cvbr";
+    if (ope_encoder_ctl(encoder, OPUS_SET_BITRATE(options.opus_bitrate *
+                                                  1000)) != OPE_OK ||
+        ope_encoder_ctl(encoder, OPUS_SET_VBR(vbr ? 1 : 0)) != OPE_OK ||
+        ope_encoder_ctl(encoder,
+                        OPUS_SET_VBR_CONSTRAINT(constrained ? 1 : 0)) !=
+            OPE_OK ||
+        ope_encoder_ctl(encoder,
+                        OPUS_SET_COMPLEXITY(options.opus_complexity)) !=
+            OPE_OK ||
+        ope_encoder_ctl(encoder, OPUS_SET_EXPERT_FRAME_DURATION(frame_duration(
+                                     options.opus_frame_ms))) != OPE_OK) {
+      std::cerr << "Warning: Could not apply all Opus encoder settings for "
+                << path << std::endl;
+    }
+    return std::unique_ptr<OpusWriter>(new OpusWriter(encoder));
+  }
+
+  ~OpusWriter() override {
+    if (encoder) {
+      ope_encoder_destroy(encoder);
+    }
+  }
+
+  bool write(const float *interleaved, int frames) override {
+    int result = ope_encoder_write_float(encoder, interleaved, frames);
+    if (result != OPE_OK) {
+      std::cerr << "Error writing to output file: " << ope_strerror(result)
+                << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool finish() override {
+    int result = ope_encoder_drain(encoder);
+    ope_encoder_destroy(encoder);
+    encoder = nullptr;
+    return result == OPE_OK;
+  }
+
+private:
+  OggOpusEnc *encoder;
+
+  explicit OpusWriter(OggOpusEnc *encoder) : encoder(encoder) {}
+
+  static int frame_duration(double ms) {
+    if (ms <= 2.5) return OPUS_FRAMESIZE_2_5_MS;
+    if (ms <= 5.0) return OPUS_FRAMESIZE_5_MS;
+    if (ms <= 10.0) return OPUS_FRAMESIZE_10_MS;
+    if (ms <= 20.0) return OPUS_FRAMESIZE_20_MS;
+    if (ms <= 40.0) return OPUS_FRAMESIZE_40_MS;
+    return OPUS_FRAMESIZE_60_MS;
+  }
+};
+#endif
+
+// Band-limited resampler for arbitrary rate ratios: a Kaiser-windowed sinc
+// stored as a polyphase table, interpolated linearly between phases. Used to
+// derive extra output rates from a single render.
+class Resampler {
+public:
+  Resampler(int in_rate, int out_rate, int channels) : channels(channels) {
+    int64_t g = std::gcd(in_rate, out_rate);
+    step_num = in_rate / g;
+    step_den = out_rate / g;
+
+    // Widen the kernel when downsampling so the transition band stays put
+    double ratio = std::min(1.0, static_cast<double>(out_rate) / in_rate);
+    taps = 2 * static_cast<int>(std::ceil(HALF_TAPS / ratio));
+    double cutoff = 0.5 * ratio * PASSBAND;
+
+    table.resize(static_cast<size_t>(PHASES + 1) * taps);
+    for (int p = 0; p <= PHASES; ++p) {
+      for (int k = 0; k < taps; ++k) {
+        double x = k - taps / 2 + 1 - static_cast<double>(p) / PHASES;
+        table[p * taps + k] =
+            static_cast<float>(2.0 * cutoff * sinc(2.0 * cutoff * x) *
+                               kaiser(x / (taps / 2)));
+      }
+    }
+
+    // Zeros before the first input sample keep output aligned with input
+    history.assign(static_cast<size_t>(taps) * channels, 0.0f);
+    history_start = -taps;
+  }
+
+  // Appends the resampled frames that the input so far allows to out
+  void process(const float *in, int frames, std::vector<float> &out) {
+    history.insert(history.end(), in, in + frames * channels);
+    input_frames += frames;
+    produce(input_frames, out);
+  }
+
+  // Pads with silence and emits the remaining frames, so the output length
+  // is exactly ceil(input_frames * out_rate / in_rate)
+  void flush(std::vector<float> &out) {
+    history.insert(history.end(), static_cast<size_t>(taps) * channels, 0.0f);
+    int64_t total = (input_frames * step_den + step_num - 1) / step_num;
+    produce(input_frames + taps, out, total);
+  }
+
+private:
+  static constexpr int PHASES = 512;
+  static constexpr int HALF_TAPS = 32;
+  static constexpr double PASSBAND = 0.95;
+  static constexpr double KAISER_BETA = 9.0;
+
+  int channels;
+  int64_t step_num;
+  int64_t step_den;
+  int taps;
+  std::vector<float> table;
+  std::vector<float> coeffs;
+  std::vector<float> history; // interleaved, starting at input history_start
+  int64_t history_start;
+  int64_t input_frames = 0;
+  int64_t output_frames = 0;
+
+  static double sinc(double x) {
+    return x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+  }
+
+  static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; ++k) {
+      term *= (x / (2.0 * k)) * (x / (2.0 * k));
+      sum += term;
+    }
+    return sum;
+  }
+
+  static double kaiser(double x) {
+    if (std::fabs(x) > 1.0) {
+      return 0.0;
+    }
+    return bessel_i0(KAISER_BETA * std::sqrt(1.0 - x * x)) /
+           bessel_i0(KAISER_BETA);
+  }
+
+  void produce(int64_t available, std::vector<float> &out,
+               int64_t limit = std::numeric_limits<int64_t>::max()) {
+    coeffs.resize(taps);
+    while (output_frames < limit) {
+      // Output frame n sits at input position n * in_rate / out_rate
+      int64_t position = output_frames * step_num;
+      int64_t center = position / step_den;
+      if (center + taps / 2 >= available) {
+        break;
+      }
+      double phase = static_cast<double>(position % step_den) / step_den *
+                     PHASES;
+      int p = static_cast<int>(phase);
+      float frac = static_cast<float>(phase - p);
+      const float *t0 = &table[p * taps];
+      const float *t1 = t0 + taps;
+      for (int k = 0; k < taps; ++k) {
+        coeffs[k] = t0[k] + frac * (t1[k] - t0[k]);
+      }
+
+      const float *window =
+          &history[(center - taps / 2 + 1 - history_start) * channels];
+      size_t base = out.size();
+      out.resize(base + channels, 0.0f);
+      for (int k = 0; k < taps; ++k) {
+        for (int c = 0; c < channels; ++c) {
+          out[base + c] += coeffs[k] * window[k * channels + c];
+        }
+      }
+      ++output_frames;
+    }
+
+    // Drop input that no future output frame can reach
+    int64_t needed = (output_frames * step_num) / step_den - taps / 2 + 1;
+    if (needed > history_start) {
+      history.erase(history.begin(),
+                    history.begin() + (needed - history_start) * channels);
+      history_start = needed;
+    }
+  }
+};
+
+// Feeds another writer with audio converted to a different sample rate
+class ResamplingWriter : public StemWriter {
+public:
+  ResamplingWriter(std::unique_ptr<StemWriter> inner, int in_rate,
+                   int out_rate, int channels)
+      : inner(std::move(inner)), resampler(in_rate, out_rate, channels),
+        channels(channels) {}
+
+  bool write(const float *interleaved, int frames) override {
+    converted.clear();
+    resampler.process(interleaved, frames, converted);
+    return write_converted();
+  }
+
+  bool finish() override {
+    converted.clear();
+    resampler.flush(converted);
+    return write_converted() && inner->finish();
+  }
+
+private:
+  std::unique_ptr<StemWriter> inner;
+  Resampler resampler;
+  int channels;
+  std::vector<float> converted;
+
+  bool write_converted() {
+    int frames = static_cast<int>(converted.size() / channels);
+    return frames == 0 || inner->write(converted.data(), frames);
+  }
+};
+
+// Runs another writer on its own thread so the render loop only renders and
+// measures. Blocks are handed over through a bounded queue, which keeps
+// memory flat when the encoder is slower than rendering.
+class AsyncWriter : public StemWriter {
+public:
+  AsyncWriter(std::unique_ptr<StemWriter> inner, int channels,
+              size_t max_queued_blocks)
+      : inner(std::move(inner)), channels(channels),
+        max_queued_blocks(max_queued_blocks) {
+    worker = std::thread(&AsyncWriter::run, this);
+  }
+
+  ~AsyncWriter() override {
+    if (worker.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+      }
+      changed.notify_all();
+      worker.join();
+    }
+  }
+
+  bool write(const float *interleaved, int frames) override {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] {
+      return failed || queue.size() < max_queued_blocks;
+    });
+    if (failed) {
+      return false;
+    }
+    std::vector<float> block;
+    if (!spare.empty()) {
+      block = std::move(spare.back());
+      spare.pop_back();
+    }
+    block.assign(interleaved, interleaved + frames * channels);
+    queue.push_back(std::move(block));
+    lock.unlock();
+    changed.notify_all();
+    return true;
+  }
+
+  bool finish() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closing = true;
+    }
+    changed.notify_all();
+    worker.join();
+    return !failed && inner->finish();
+  }
+
+private:
+  std::unique_ptr<StemWriter> inner;
+  int channels;
+  size_t max_queued_blocks;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::vector<float>> queue;
+  std::vector<std::vector<float>> spare; // recycled block buffers
+  bool closing = false;
+  bool failed = false;
+  std::thread worker;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      changed.wait(lock, [this] { return closing || !queue.empty(); });
+      if (queue.empty()) {
+        return; // closing and drained
+      }
+      std::vector<float> block = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+      changed.notify_all();
+
+      bool ok = inner->write(block.data(),
+                             static_cast<int>(block.size() / channels));
+
+      lock.lock();
+      spare.push_back(std::move(block));
+      if (!ok) {
+        failed = true;
+        queue.clear();
+        changed.notify_all();
+        return;
+      }
+    }
+  }
+};
+
+// Quoted JSON string with quotes, backslashes and control characters escaped
+std::string jsonString(const std::string &value) {
+  std::string escaped = "\"";
+  for (unsigned char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += static_cast<char>(c);
+    } else if (c < 0x20) {
+      char code[8];
+      std::snprintf(code, sizeof(code), "\\u%04x", c);
+      escaped += code;
+    } else {
+      escaped += static_cast<char>(c);
+    }
+  }
+  return escaped + "\"";
+}
+
+// JSON has no infinities; silent stems report null loudness
+std::string jsonNumber(double value) {
+  if (!std::isfinite(value)) {
+    return "null";
+  }
+  char number[32];
+  std::snprintf(number, sizeof(number), "%.2f", value);
+  return number;
+}
+
+// Per-stem entry of the module report
+struct StemReport {
+  int index = 0;   // instrument/sample, or channel with --split-by channel
+  int channel = 0; // 1-based, with --split-by instrument-channel
+  std::string name;
+  std::vector<std::string> files; // relative to the module directory
+  uint64_t frames = 0;
+  double integrated_lufs = 0.0;
+  double true_peak_dbtp = 0.0;
+  double sample_peak_dbfs = 0.0;
+  uint64_t content_hash = 0; // of the rendered samples
+  std::string alias_of; // file of an identical earlier stem, if linked to it
+  int stopped_at = 0;   // render limit that stopped the stem, if any
+};
+
+// What stopped the rendering of a module or of one stem. --max-duration
+// does not stop it; the stems are cut off there and the module marked
+// truncated. --stem-timeout stops only the stem that reached it.
+enum RenderLimit : int { LIMIT_NONE = 0, LIMIT_TIMEOUT, LIMIT_STEM_TIMEOUT };
+
+const char *renderLimitName(int limit) {
+  switch (limit) {
+  case LIMIT_TIMEOUT:
+    return "timeout";
+  case LIMIT_STEM_TIMEOUT:
+    return "stem_timeout";
+  default:
+    return "none";
+  }
+}
+
+// Collects per-stem measurements and writes them as report.json next to the
+// stems of a module.
+class ModuleReport {
+public:
+  ModuleReport(const std::string &module_name, const AudioOptions &options)
+      : module_name(module_name), options(options) {}
+
+  void add_stem(const StemReport &stem) { stems.push_back(stem); }
+
+  // A stem stopped at a render limit, with the limit in stopped_at
+  void add_stopped(const StemReport &stem) { stopped.push_back(stem); }
+
+  bool has_stopped() const { return !stopped.empty(); }
+
+  void set_limit(int limit) { this->limit = limit; }
+
+  void set_truncated() { truncated = true; }
+
+  std::vector<StemReport> &entries() { return stems; }
+
+  bool write(const std::string &path) const {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+      return false;
+    }
+    // Render workers finish stems out of order
+    std::vector<StemReport> stems = this->stems;
+    std::sort(stems.begin(), stems.end(),
+              [](const StemReport &a, const StemReport &b) {
+                return a.index != b.index ? a.index < b.index
+                                          : a.channel < b.channel;
+              });
+    out << "{\n";
+    out << "  \"module\": " << jsonString(module_name) << ",\n";
+    out << "  \"sample_rate\": " << options.sample_rate << ",\n";
+    out << "  \"output_sample_rates\": [";
+    for (size_t i = 0; i < options.sample_rates.size(); ++i) {
+      out << (i ? ", " : "") << options.sample_rates[i];
+    }
+    out << "],\n";
+    out << "  \"channels\": " << options.channels << ",\n";
+    out << "  \"formats\": [";
+    for (size_t i = 0; i < options.output_formats.size(); ++i) {
+      out << (i ? ", " : "") << jsonString(options.output_formats[i]);
+    }
+    out << "],\n";
+    out << "  \"split_by\": " << jsonString(options.split_by) << ",\n";
+    if (limit != LIMIT_NONE) {
+      out << "  \"render_limit\": " << jsonString(renderLimitName(limit))
+          << ",\n";
+    }
+    if (truncated) {
+      out << "  \"truncated\": true,\n";
+      out << "  \"max_duration\": " << jsonNumber(options.max_duration)
+          << ",\n";
+    }
+    out << "  \"stems\": [";
+    for (size_t i = 0; i < stems.size(); ++i) {
+      const StemReport &stem = stems[i];
+      out << (i ? ",\n" : "\n");
+      out << "    {\"index\": " << stem.index;
+      if (stem.channel > 0) {
+        out << ", \"channel\": " << stem.channel;
+      }
+      out << ", \"name\": " << jsonString(stem.name)
+          << ", \"files\": [";
+      for (size_t f = 0; f < stem.files.size(); ++f) {
+        out << (f ? ", " : "") << jsonString(stem.files[f]);
+      }
+      out << "]";
+      if (!stem.alias_of.empty()) {
+        out << ", \"alias_of\": " << jsonString(stem.alias_of);
+      }
+      out << ", \"frames\": " << stem.frames
+          << ", \"integrated_lufs\": " << jsonNumber(stem.integrated_lufs)
+          << ", \"true_peak_dbtp\": " << jsonNumber(stem.true_peak_dbtp)
+          << ", \"sample_peak_dbfs\": " << jsonNumber(stem.sample_peak_dbfs)
+          << "}";
+    }
+    out << (stems.empty() ? "]" : "\n  ]");
+    if (!stopped.empty()) {
+      std::vector<StemReport> stopped = this->stopped;
+      std::sort(stopped.begin(), stopped.end(),
+                [](const StemReport &a, const StemReport &b) {
+                  return a.index != b.index ? a.index < b.index
+                                            : a.channel < b.channel;
+                });
+      out << ",\n  \"stopped_stems\": [";
+      for (size_t i = 0; i < stopped.size(); ++i) {
+        const StemReport &stem = stopped[i];
+        out << (i ? ",\n" : "\n");
+        out << "    {\"index\": " << stem.index;
+        if (stem.channel > 0) {
+          out << ", \"channel\": " << stem.channel;
+        }
+        out << ", \"name\": " << jsonString(stem.name)
+            << ", \"render_limit\": "
+            << jsonString(renderLimitName(stem.stopped_at)) << "}";
+      }
+      out << "\n  ]";
+    }
+    out << "\n}\n";
+    return static_cast<bool>(out);
+  }
+
+private:
+  std::string module_name;
+  AudioOptions options;
+  std::vector<StemReport> stems;
+  std::vector<StemReport> stopped;
+  int limit = LIMIT_NONE;
+  bool truncated = false; // stems cut off at --max-duration
+};
+
+// Totals printed at the end of a run; render workers update them
+// concurrently
+struct RunSummary {
+  std::atomic<int> stems_written{0};
+  std::atomic<int> stems_silent{0};
+  std::atomic<int> stems_failed{0};
+  std::atomic<int> stems_stopped{0}; // cut short or never started
+  int stems_identical = 0;           // aliases of an earlier stem
+  int limit = LIMIT_NONE;            // what stopped the module, if anything
+  bool truncated = false;            // stems cut off at --max-duration
+  int render_workers = 1;
+  size_t memory_estimate = 0; // bytes, planned peak of the extraction
+  int probe_renders = 0;      // silence probe renders of the module
+  int probed_sources = 0;
+};
+
+// Current resident set size of the process in bytes; 0 where unsupported
+size_t residentBytes() {
+#ifdef __linux__
+  std::ifstream statm("/proc/self/statm");
+  size_t pages = 0;
+  size_t resident = 0;
+  if (statm >> pages >> resident) {
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  }
+#endif
+  return 0;
+}
+
+// Highest resident set size the process reached, in bytes; 0 where
+// unsupported
+size_t peakResidentBytes() {
+#ifdef __linux__
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // reported in KiB
+  }
+#endif
+  return 0;
+}
+
+std::string formatMebibytes(size_t bytes) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.1f MiB",
+                static_cast<double>(bytes) / (1024.0 * 1024.0));
+  return text;
+}
+
+// Calls visit(channel, instrument) for every instrument reference in the
+// patterns of the order list, with the instrument 1-based as in the
+// pattern data. Each pattern is scanned once.
+template <typename Visit>
+void scanPatternInstruments(const openmpt::module &mod, Visit visit) {
+  const int32_t num_patterns = mod.get_num_patterns();
+  const int32_t num_channels = mod.get_num_channels();
+  std::vector<bool> scanned(num_patterns, false);
+  for (int32_t order = 0; order < mod.get_num_orders(); ++order) {
+    int32_t pattern = mod.get_order_pattern(order);
+    // Skips "+++" and "---" order markers and repeated patterns
+    if (pattern < 0 || pattern >= num_patterns || scanned[pattern]) {
+      continue;
+    }
+    scanned[pattern] = true;
+    const int32_t rows = mod.get_pattern_num_rows(pattern);
+    for (int32_t row = 0; row < rows; ++row) {
+      for (int32_t channel = 0; channel < num_channels; ++channel) {
+        int instrument = mod.get_pattern_row_channel_command(
+            pattern, row, channel, openmpt::module::command_instrument);
+        if (instrument > 0) {
+          visit(channel, instrument);
+        }
+      }
+    }
+  }
+}
+
+// Instruments, or samples for formats without instruments, that the
+// patterns refer to. Index i is instrument i + 1 of the pattern data;
+// anything never referenced cannot play.
+std::vector<bool> referencedInstruments(const openmpt::module &mod,
+                                        int count) {
+  std::vector<bool> used(count, false);
+  scanPatternInstruments(mod, [&used, count](int, int instrument) {
+    if (instrument <= count) {
+      used[instrument - 1] = true;
+    }
+  });
+  return used;
+}
+
+// (instrument, channel) pairs, both 0-based, that occur in the patterns,
+// ordered by instrument then channel
+std::vector<std::pair<int, int>>
+referencedInstrumentChannels(const openmpt::module &mod, int count) {
+  std::set<std::pair<int, int>> pairs;
+  scanPatternInstruments(mod, [&pairs, count](int channel, int instrument) {
+    if (instrument <= count) {
+      pairs.emplace(instrument - 1, channel);
+    }
+  });
+  return std::vector<std::pair<int, int>>(pairs.begin(), pairs.end());
+}
+
+// Largest module decompressed from an archive or gzip stream, which keeps
+// a corrupt or hostile input from taking all memory
+constexpr size_t MAX_INPUT_BYTES = size_t(1) << 30;
+
+// Inflates a zlib, gzip (window_bits + 32 detects either) or raw deflate
+// (negative window_bits) stream. Concatenated gzip members are all read,
+// and zeros padding the last one are ignored, as gzip itself does.
+std::vector<char> inflateData(const char *data, size_t size, int window_bits,
+                              size_t expected_size, const std::string &what) {
+#ifdef HAVE_ZLIB
+  std::vector<char> out(std::min(std::max<size_t>(expected_size, 65536),
+                                 MAX_INPUT_BYTES));
+  z_stream stream = {};
+  if (inflateInit2(&stream, window_bits) != Z_OK) {
+    throw std::runtime_error("Could not start decompressing " + what);
+  }
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+  stream.avail_in = static_cast<uInt>(size);
+  size_t produced = 0;
+  int result = Z_OK;
+  while (true) {
+    if (produced == out.size()) {
+      if (out.size() >= MAX_INPUT_BYTES) {
+        inflateEnd(&stream);
+        throw std::runtime_error("Decompressed " + what + " exceeds " +
+                                 std::to_string(MAX_INPUT_BYTES >> 20) +
+                                 " MiB");
+      }
+      out.resize(std::min(out.size() * 2, MAX_INPUT_BYTES));
+    }
+    stream.next_out = reinterpret_cast<Bytef *>(out.data() + produced);
+    stream.avail_out = static_cast<uInt>(out.size() - produced);
+    result = inflate(&stream, Z_NO_FLUSH);
+    produced = out.size() - stream.avail_out;
+    if (result == Z_STREAM_END) {
+      if (window_bits < 0 ||
+          std::all_of(stream.next_in, stream.next_in + stream.avail_in,
+                      [](Bytef byte) { return byte == 0; })) {
+        break;
+      }
+      inflateReset(&stream); // next gzip member
+    } else if (result != Z_OK && result != Z_BUF_ERROR) {
+      break;
+    } else if (result == Z_BUF_ERROR && stream.avail_in == 0) {
+      break; // truncated
+    }
+  }
+  inflateEnd(&stream);
+  if (result != Z_STREAM_END) {
+    throw std::runtime_error("Corrupt compressed data in " + what);
+  }
+  out.resize(produced);
+  return out;
+#else
+  (void)data;
+  (void)size;
+  (void)window_bits;
+  (void)expected_size;
+  throw std::runtime_error("Cannot decompress " + what +
+                           ": built without zlib");
+#endif
+}
+
+bool isGzip(const std::vector<char> &data) {
+  return data.size() >= 2 && static_cast<unsigned char>(data[0]) == 0x1f &&
+         static_cast<unsigned char>(data[1]) == 0x8b;
+}
+
+// Little-endian field of a zip header
+uint32_t zipField(const char *at, int bytes) {
+  uint32_t value = 0;
+  for (int i = bytes - 1; i >= 0; --i) {
+    value = (value << 8) | static_cast<unsigned char>(at[i]);
+  }
+  return value;
+}
+
+// Entry table of a zip archive, read from its central directory. Entries
+// are read one at a time straight from their offset, so a batch over the
+// archive streams through it without unpacking anything to disk. Stored
+// and deflated entries are supported, not Zip64 or encryption.
+class ZipArchive {
+public:
+  struct Entry {
+    std::string name;
+    uint32_t method = 0;
+    uint64_t offset = 0; // of the local header
+    uint64_t compressed_size = 0;
+    uint64_t size = 0;
+  };
+
+  // An archive stays parsed while anything holds it, as a batch over its
+  // entries does (see archiveInputs), so reading the entries one by one
+  // parses the directory once. Nothing outlives the batch.
+  static std::shared_ptr<ZipArchive> open(const std::string &path) {
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<ZipArchive>> open_archives;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = open_archives.begin(); it != open_archives.end();) {
+      it = it->second.expired() ? open_archives.erase(it) : std::next(it);
+    }
+    std::shared_ptr<ZipArchive> archive = open_archives[path].lock();
+    if (!archive) {
+      archive = std::shared_ptr<ZipArchive>(new ZipArchive(path));
+      open_archives[path] = archive;
+    }
+    return archive;
+  }
+
+  const std::vector<Entry> &entries() const { return table; }
+
+  std::vector<char> read(const std::string &name) const {
+    auto it = std::find_if(table.begin(), table.end(),
+                           [&](const Entry &e) { return e.name == name; });
+    if (it == table.end()) {
+      throw std::runtime_error("No entry " + name + " in " + path);
+    }
+    const Entry &entry = *it;
+    std::ifstream file(path, std::ios::binary);
+    char header[30];
+    file.seekg(static_cast<std::streamoff>(entry.offset));
+    if (!file.read(header, sizeof(header)) ||
+        zipField(header, 4) != 0x04034b50) {
+      throw std::runtime_error("Corrupt zip entry " + name + " in " + path);
+    }
+    file.seekg(zipField(header + 26, 2) + zipField(header + 28, 2),
+               std::ios::cur);
+    std::string what = path + ":" + name;
+    if (entry.compressed_size > MAX_INPUT_BYTES ||
+        entry.size > MAX_INPUT_BYTES) {
+      throw std::runtime_error("Zip entry " + what + " exceeds " +
+                               std::to_string(MAX_INPUT_BYTES >> 20) +
+                               " MiB");
+    }
+    std::vector<char> data(entry.compressed_size);
+    if (!file.read(data.data(), static_cast<std::streamsize>(data.size()))) {
+      throw std::runtime_error("Truncated zip entry " + what);
+    }
+    if (entry.method == 0) {
+      return data;
+    }
+    if (entry.method != 8) {
+      throw std::runtime_error("Unsupported compression method " +
+                               std::to_string(entry.method) + " in " + what);
+    }
+    // Zip entries hold raw deflate streams
+    return inflateData(data.data(), data.size(), -15,
+                       static_cast<size_t>(entry.size), what);
+  }
+
+  // Tells zip archives from modules by their signature
+  static bool is_archive(const std::string &path) {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error)) {
+      return false;
+    }
+    std::ifstream file(path, std::ios::binary);
+    char magic[4];
+    return file.read(magic, sizeof(magic)) && zipField(magic, 4) == 0x04034b50;
+  }
+
+private:
+  std::string path;
+  std::vector<Entry> table;
+
+  explicit ZipArchive(const std::string &path) : path(path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+      throw std::runtime_error("Could not open input file: " + path);
+    }
+    // The end of central directory record sits before a comment of up to
+    // 64 KiB at the end of the file
+    uint64_t file_size = static_cast<uint64_t>(file.tellg());
+    size_t tail_size =
+        static_cast<size_t>(std::min<uint64_t>(file_size, 22 + 65535));
+    std::vector<char> tail(tail_size);
+    file.seekg(static_cast<std::streamoff>(file_size - tail_size));
+    file.read(tail.data(), static_cast<std::streamsize>(tail_size));
+    size_t end = std::string::npos;
+    for (size_t i = tail_size >= 22 ? tail_size - 22 + 1 : 0; i-- > 0;) {
+      if (zipField(tail.data() + i, 4) == 0x06054b50) {
+        end = i;
+        break;
+      }
+    }
+    if (!file || end == std::string::npos) {
+      throw std::runtime_error("Not a zip archive: " + path);
+    }
+    const char *record = tail.data() + end;
+    uint32_t count = zipField(record + 10, 2);
+    uint32_t directory_size = zipField(record + 12, 4);
+    uint32_t directory_offset = zipField(record + 16, 4);
+    if (count == 0xFFFF || directory_offset == 0xFFFFFFFF) {
+      throw std::runtime_error("Zip64 archives are not supported: " + path);
+    }
+
+    std::vector<char> directory(directory_size);
+    file.seekg(directory_offset);
+    if (!file.read(directory.data(), directory_size)) {
+      throw std::runtime_error("Corrupt zip directory in " + path);
+    }
+    size_t at = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      if (at + 46 > directory.size() ||
+          zipField(directory.data() + at, 4) != 0x02014b50) {
+        throw std::runtime_error("Corrupt zip directory in " + path);
+      }
+      const char *header = directory.data() + at;
+      size_t name_size = zipField(header + 28, 2);
+      size_t skip = name_size + zipField(header + 30, 2) +
+                    zipField(header + 32, 2);
+      if (at + 46 + name_size > directory.size()) {
+        throw std::runtime_error("Corrupt zip directory in " + path);
+      }
+      Entry entry;
+      entry.name.assign(header + 46, name_size);
+      entry.method = zipField(header + 10, 2);
+      entry.compressed_size = zipField(header + 20, 4);
+      entry.size = zipField(header + 24, 4);
+      entry.offset = zipField(header + 42, 4);
+      bool encrypted = zipField(header + 8, 2) & 1;
+      at += 46 + skip;
+      if (encrypted) {
+        std::cerr << "Warning: Skipping encrypted zip entry " << entry.name
+                  << " in " << path << std::endl;
+        continue;
+      }
+      table.push_back(std::move(entry));
+    }
+  }
+};
+
+// Splits "pack.zip:dir/song.xm" into the archive and the entry. A file
+// that exists under the whole name is not split.
+bool splitArchiveEntry(const std::string &input, std::string &archive,
+                       std::string &entry) {
+  std::error_code error;
+  if (input == "-" || std::filesystem::exists(input, error)) {
+    return false;
+  }
+  for (size_t colon = input.find(':'); colon != std::string::npos;
+       colon = input.find(':', colon + 1)) {
+    if (ZipArchive::is_archive(input.substr(0, colon))) {
+      archive = input.substr(0, colon);
+      entry = input.substr(colon + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reads a whole input into memory: a file, "-" for standard input, or an
+// entry of a zip archive. Gzip-compressed data is decompressed. On Linux
+// the kernel is told files are read sequentially, so it reads ahead in
+// larger chunks.
+std::vector<char> readInputFile(const std::string &path) {
+  std::vector<char> data;
+  std::string archive, entry;
+  if (path == "-") {
+    data.assign(std::istreambuf_iterator<char>(std::cin),
+                std::istreambuf_iterator<char>());
+  } else if (splitArchiveEntry(path, archive, entry)) {
+    data = ZipArchive::open(archive)->read(entry);
+  } else {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+      throw std::runtime_error("Could not open input file: " + path);
+    }
+#ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      close(fd);
+    }
+#endif
+    data.assign(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+  }
+  if (isGzip(data)) {
+    data = inflateData(data.data(), data.size(), 15 + 32, data.size() * 4,
+                       path);
+  }
+  return data;
+}
+
+// Raised for an input whose first bytes match no module format
+struct NotAModuleError : std::runtime_error {
+  explicit NotAModuleError(const std::string &path)
+      : std::runtime_error("Not a module file: " + path) {}
+};
+
+// Rejects a file that libopenmpt's header probe rules out, from its first
+// bytes only, before it is read whole and parsed. Standard input, archive
+// entries and gzip data are left to the loader.
+void probeModuleHeader(const std::string &path) {
+  std::string archive, entry;
+  if (path == "-" || splitArchiveEntry(path, archive, entry)) {
+    return;
+  }
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return; // reported by the loader
+  }
+  uint64_t file_size = static_cast<uint64_t>(file.tellg());
+  std::vector<char> head(static_cast<size_t>(std::min<uint64_t>(
+      file_size, openmpt::probe_file_header_get_recommended_size())));
+  file.seekg(0);
+  if (!file.read(head.data(), static_cast<std::streamsize>(head.size())) ||
+      isGzip(head)) {
+    return;
+  }
+  if (openmpt::probe_file_header(
+          openmpt::probe_file_header_flags_default,
+          reinterpret_cast<const std::uint8_t *>(head.data()), head.size(),
+          file_size) ==
+      openmpt::probe_file_header_result_failure) {
+    throw NotAModuleError(path);
+  }
+}
+
+// Name of the module output directory: the input file or archive entry
+// name without its extension, and without .gz before that
+std::string moduleName(const std::string &input) {
+  if (input == "-") {
+    return "stdin";
+  }
+  std::string name = input.substr(input.find_last_of("/\\:") + 1);
+  if (name.size() > 3 &&
+      (name.compare(name.size() - 3, 3, ".gz") == 0 ||
+       name.compare(name.size() - 3, 3, ".GZ") == 0)) {
+    name.resize(name.size() - 3);
+  }
+  size_t dot_pos = name.find_last_of(".");
+  if (dot_pos != std::string::npos) {
+    name.resize(dot_pos);
+  }
+  return name;
+}
+
+// Starts reading a file into the page cache in the background, for a
+// module that will be loaded soon
+void adviseWillNeed(const std::string &path) {
+#ifdef __linux__
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+#else
+  (void)path;
+#endif
+}
+
+// Catalogue metadata of a module, read without rendering any audio.
+// Sample data and plugins are not loaded, which makes parsing cheap
+// enough to index large collections.
+class ModuleInfo {
+public:
+  explicit ModuleInfo(const std::string &path) : path(path) {
+    probeModuleHeader(path);
+    std::vector<char> data = readInputFile(path);
+    openmpt::module mod(data, std::clog,
+                        {{"load.skip_samples", "1"},
+                         {"load.skip_plugins", "1"}});
+
+    title = mod.get_metadata("title");
+    type = mod.get_metadata("type");
+    channels = mod.get_num_channels();
+    orders = mod.get_num_orders();
+    patterns = mod.get_num_patterns();
+    duration = mod.get_duration_seconds();
+
+    // Same stem sources as the extraction: instruments, else samples
+    names = mod.get_instrument_names();
+    if (mod.get_num_instruments() == 0) {
+      names = mod.get_sample_names();
+      using_samples = true;
+    }
+    used = referencedInstruments(mod, static_cast<int>(names.size()));
+
+    std::vector<std::string> subsong_names = mod.get_subsong_names();
+    for (int32_t i = 0; i < mod.get_num_subsongs(); ++i) {
+      mod.select_subsong(i);
+      subsongs.push_back(
+          {static_cast<size_t>(i) < subsong_names.size() ? subsong_names[i]
+                                                         : std::string(),
+           mod.get_duration_seconds()});
+    }
+  }
+
+  // One JSON object on a single line, so batches form JSON Lines
+  std::string json() const {
+    std::ostringstream out;
+    out << "{\"file\": " << jsonString(path)
+        << ", \"title\": " << jsonString(title)
+        << ", \"type\": " << jsonString(type)
+        << ", \"channels\": " << channels << ", \"orders\": " << orders
+        << ", \"patterns\": " << patterns
+        << ", \"duration_seconds\": " << jsonNumber(duration)
+        << ", \"subsongs\": [";
+    for (size_t i = 0; i < subsongs.size(); ++i) {
+      out << (i ? ", " : "") << "{\"name\": " << jsonString(subsongs[i].name)
+          << ", \"duration_seconds\": " << jsonNumber(subsongs[i].duration)
+          << "}";
+    }
+    out << "], \"stem_source\": "
+        << jsonString(using_samples ? "sample" : "instrument")
+        << ", \"instruments\": [";
+    for (size_t i = 0; i < names.size(); ++i) {
+      out << (i ? ", " : "") << "{\"index\": " << i + 1
+          << ", \"name\": " << jsonString(names[i])
+          << ", \"used\": " << (used[i] ? "true" : "false") << "}";
+    }
+    out << "]}";
+    return out.str();
+  }
+
+  // Human-readable listing, one instrument per line
+  std::string listing() const {
+    std::ostringstream out;
+    out << path << ": " << names.size()
+        << (using_samples ? " samples, " : " instruments, ") << channels
+        << " channels, " << jsonNumber(duration) << " s";
+    if (subsongs.size() > 1) {
+      out << ", " << subsongs.size() << " subsongs";
+    }
+    out << "\n";
+    for (size_t i = 0; i < names.size(); ++i) {
+      char number[8];
+      std::snprintf(number, sizeof(number), "%03zu", i + 1);
+      out << "  " << number;
+      if (!names[i].empty()) {
+        out << " " << names[i];
+      }
+      if (!used[i]) {
+        out << " (unused)";
+      }
+      out << "\n";
+    }
+    return out.str();
+  }
+
+private:
+  struct Subsong {
+    std::string name;
+    double duration;
+  };
+
+  std::string path;
+  std::string title;
+  std::string type;
+  int channels = 0;
+  int orders = 0;
+  int patterns = 0;
+  double duration = 0.0;
+  bool using_samples = false;
+  std::vector<std::string> names;
+  std::vector<bool> used;
+  std::vector<Subsong> subsongs;
+};
+
+// Restricts the process to --cpu-list and lowers its priority. Called
+// before any thread starts: on Linux affinity, nice and scheduling policy
+// are per thread and inherited by the threads created afterwards, so
+// render workers, encoders and FLAC runs all follow.
+void applySchedulingOptions(const AudioOptions &options) {
+#ifdef __linux__
+  if (!options.cpu_list.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : options.cpu_list) {
+      CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      throw std::runtime_error(std::string("Could not restrict to CPU list: ") +
+                               std::strerror(errno));
+    }
+  }
+  if (options.sched_batch) {
+    struct sched_param param = {};
+    if (sched_setscheduler(0, SCHED_BATCH, &param) != 0) {
+      std::cerr << "Warning: Could not set SCHED_BATCH: "
+                << std::strerror(errno) << std::endl;
+    }
+  }
+  if (options.nice > 0 && setpriority(PRIO_PROCESS, 0, options.nice) != 0) {
+    std::cerr << "Warning: Could not set nice value " << options.nice << ": "
+              << std::strerror(errno) << std::endl;
+  }
+#else
+  if (!options.cpu_list.empty() || options.sched_batch || options.nice > 0) {
+    std::cerr << "Warning: --cpu-list, --nice and --sched-batch are only "
+                 "supported on Linux"
+              << std::endl;
+  }
+#endif
+}
+
+// 64-bit non-cryptographic hash fed eight bytes at a time, in pieces of
+// any size. Matches are meant to be confirmed byte for byte.
+class StreamHash {
+public:
+  void update(const void *data, size_t size) {
+    const char *bytes = static_cast<const char *>(data);
+    total += size;
+    if (pending_size > 0) {
+      size_t take = std::min(size, sizeof(pending) - pending_size);
+      std::memcpy(pending + pending_size, bytes, take);
+      pending_size += take;
+      bytes += take;
+      size -= take;
+      if (pending_size < sizeof(pending)) {
+        return;
+      }
+      mix(pending);
+      pending_size = 0;
+    }
+    for (; size >= 8; bytes += 8, size -= 8) {
+      mix(bytes);
+    }
+    std::memcpy(pending, bytes, size);
+    pending_size = size;
+  }
+
+  uint64_t digest() const {
+    uint64_t tail = 0;
+    std::memcpy(&tail, pending, pending_size);
+    uint64_t h = (state ^ tail * MULTIPLIER ^ total) * FINAL_MULTIPLIER;
+    return h ^ (h >> 29);
+  }
+
+private:
+  static constexpr uint64_t MULTIPLIER = 0x9E3779B97F4A7C15ULL;
+  static constexpr uint64_t FINAL_MULTIPLIER = 0xD6E8FEB86659FD93ULL;
+
+  uint64_t state = 0;
+  uint64_t total = 0;
+  char pending[8] = {};
+  size_t pending_size = 0;
+
+  void mix(const char *bytes) {
+    uint64_t word;
+    std::memcpy(&word, bytes, sizeof(word));
+    word *= MULTIPLIER;
+    word ^= word >> 32;
+    state = (state ^ word) * FINAL_MULTIPLIER;
+    state ^= state >> 32;
+  }
+};
+
+// A module read and parsed for extraction, ready to render
+struct LoadedModule {
+  std::string path;
+  std::vector<char> file_data; // render workers parse their own copies
+  std::unique_ptr<openmpt::module_ext> mod;
+  size_t resident_delta = 0; // what parsing made resident, if measured
+  uint64_t content_hash = 0; // of file_data, to find duplicates
+};
+
+// Parsed module state besides the sample data; a rough figure for the
+// memory budget
+constexpr size_t MODULE_BASE_BYTES = 4 * 1024 * 1024;
+
+// Estimated memory of one parsed module. Parsed samples are at least
+// 16-bit, so 8-bit and compressed sample data grows when loaded. What
+// loading actually made resident is used when it is larger.
+size_t parsedModuleBytes(size_t file_size, size_t resident_delta = 0) {
+  return std::max(MODULE_BASE_BYTES + file_size * 2, resident_delta);
+}
+
+// Loading on the thread that renders measures what parsing made resident.
+// A background load cannot tell its memory from the render's.
+LoadedModule loadModule(const std::string &path, bool measure) {
+  LoadedModule loaded;
+  loaded.path = path;
+  probeModuleHeader(path);
+  loaded.file_data = readInputFile(path);
+  StreamHash hash;
+  hash.update(loaded.file_data.data(), loaded.file_data.size());
+  loaded.content_hash = hash.digest();
+  size_t resident_before = measure ? residentBytes() : 0;
+  loaded.mod = std::make_unique<openmpt::module_ext>(loaded.file_data);
+  size_t resident_after = measure ? residentBytes() : 0;
+  if (resident_after > resident_before) {
+    loaded.resident_delta = resident_after - resident_before;
+  }
+  return loaded;
+}
+
+// Loads the modules of a batch on a background thread, up to a number of
+// modules ahead of the one rendering, so reading and parsing the next
+// module overlaps with rendering the current one. Modules are handed out
+// in input order; a module that failed to load rethrows its error from
+// next(). With a memory budget, a module is only loaded ahead while it
+// fits next to the modules already waiting and the render in progress.
+class ModulePrefetcher {
+public:
+  ModulePrefetcher(const std::vector<std::string> &paths, size_t ahead,
+                   size_t max_memory = 0)
+      : paths(paths), ahead(std::max<size_t>(1, ahead)),
+        max_memory(max_memory) {
+    worker = std::thread(&ModulePrefetcher::run, this);
+  }
+
+  ~ModulePrefetcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closing = true;
+    }
+    changed.notify_all();
+    worker.join();
+  }
+
+  // Asking for the next module ends the render of the one before. Until
+  // set_reserved() tells more, the module handed out reserves its own size.
+  LoadedModule next() {
+    std::unique_lock<std::mutex> lock(mutex);
+    reserved = 0;
+    changed.notify_all();
+    changed.wait(lock, [this] { return !ready.empty(); });
+    Entry entry = std::move(ready.front());
+    ready.pop_front();
+    held -= entry.bytes;
+    reserved = entry.bytes;
+    lock.unlock();
+    changed.notify_all();
+    if (entry.error) {
+      std::rethrow_exception(entry.error);
+    }
+    return std::move(entry.module);
+  }
+
+  // Waits for the module being loaded and holds the next one back while
+  // the lock is held, so a fork does not copy locks the loader holds
+  std::unique_lock<std::mutex> pause() {
+    return std::unique_lock<std::mutex>(loading);
+  }
+
+  // Memory held by the modules loaded and waiting for their turn
+  size_t held_bytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return held;
+  }
+
+  // Memory planned for the render in progress, besides held_bytes()
+  void set_reserved(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      reserved = bytes;
+    }
+    changed.notify_all();
+  }
+
+private:
+  struct Entry {
+    LoadedModule module;
+    std::exception_ptr error;
+    size_t bytes = 0; // file and parsed module
+  };
+
+  std::vector<std::string> paths;
+  size_t ahead;
+  size_t max_memory;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<Entry> ready;
+  size_t held = 0;
+  size_t reserved = 0;
+  bool closing = false;
+  std::mutex loading; // held by the loader while it reads and parses
+  std::thread worker;
+
+  void run() {
+    for (size_t i = 0; i < paths.size(); ++i) {
+      // Compressed input grows more than this; the estimate is corrected
+      // once the module is loaded
+      std::error_code error;
+      uintmax_t file_size = std::filesystem::file_size(paths[i], error);
+      size_t estimate =
+          error ? MODULE_BASE_BYTES
+                : static_cast<size_t>(file_size) + parsedModuleBytes(file_size);
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this, estimate] {
+          return closing || (ready.size() < ahead && fits(estimate));
+        });
+        if (closing) {
+          return;
+        }
+      }
+      {
+        std::lock_guard<std::mutex> busy(loading);
+        // The files after this one are read into the page cache while
+        // this one parses
+        for (size_t j = i + 1; j < std::min(paths.size(), i + 1 + ahead);
+             ++j) {
+          adviseWillNeed(paths[j]);
+        }
+        Entry entry;
+        try {
+          entry.module = loadModule(paths[i], false);
+          size_t file_bytes = entry.module.file_data.size();
+          entry.bytes = file_bytes + parsedModuleBytes(file_bytes);
+        } catch (...) {
+          entry.error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        held += entry.bytes;
+        ready.push_back(std::move(entry));
+      }
+      changed.notify_all();
+    }
+  }
+
+  // Whether a module of this size may be loaded now. With nothing waiting
+  // and no render in progress, it is loaded whatever its size, as it would
+  // be without the loader.
+  bool fits(size_t bytes) const {
+    return max_memory == 0 || (ready.empty() && reserved == 0) ||
+           held + reserved + bytes <= max_memory;
+  }
+};
+
+class StemExtractor {
+private:
+  std::unique_ptr<openmpt::module_ext> mod;
+  std::string input_path;
+  std::vector<char> file_data; // render workers parse their own copies
+  size_t module_bytes = 0;     // estimated memory of one parsed module
+  AudioOptions options;
+  RunSummary summary;
+  std::mutex results_mutex; // report entries from concurrent workers
+  std::mutex log_mutex;
+  int result_fd = -1; // pipe to the parent, in a forked render worker
+  ModulePrefetcher *prefetcher = nullptr; // paused while workers fork
+
+public:
+  explicit StemExtractor(const std::string &path, const AudioOptions &opts = {})
+      : StemExtractor(loadModule(path, true), opts) {}
+
+  // Takes over a module loaded ahead, as by ModulePrefetcher
+  StemExtractor(LoadedModule loaded, const AudioOptions &opts)
+      : mod(std::move(loaded.mod)), input_path(loaded.path),
+        file_data(std::move(loaded.file_data)), options(opts) {
+    module_bytes = parsedModuleBytes(file_data.size(), loaded.resident_delta);
+
+    // Adjust channels based on stereo separation: if 0, stereo is mono.
+    // Quad keeps its rear pair, which separation does not fold into the front
+    AudioOptions adjusted_opts = options;
+    if (adjusted_opts.stereo_separation == 0 && adjusted_opts.channels == 2) {
+      adjusted_opts.channels = 1;  // Mono when stereo separation is 0
+    }
+
+    // Update the stored options with adjusted values
+    const_cast<AudioOptions&>(options) = adjusted_opts;
+
+    // Set up audio parameters
+    configure_module(*mod);
+  }
+
+  // Where the stems and report of a module go
+  static std::string module_dir(const std::string &output_dir,
+                                const std::string &path) {
+    return output_dir + "/" + sanitize_filename(moduleName(path));
+  }
+
+  // The batch's loader thread, paused while render workers are forked
+  void set_prefetcher(ModulePrefetcher *loader) { prefetcher = loader; }
+
+  // Whether the stems were cut off at --max-duration
+  bool truncated() const { return summary.truncated; }
+
+  // Returns false when --timeout stopped the module
+  bool extractStems(const std::string &output_dir) {
+    // The module's wall time runs from here
+    RenderLimits limits = render_limits();
+
+    // Get the number of instruments
+    int num_instruments = mod->get_num_instruments();
+    std::cout << "Found " << num_instruments << " instruments." << std::endl;
+
+    // If no instruments, try using samples instead
+    bool using_samples = false;
+    if (num_instruments == 0) {
+      // Some formats use samples instead of instruments
+      // We'll need to determine the number of samples differently
+      std::cout << "No instruments found, checking for samples..." << std::endl;
+
+      // For formats like MOD, we should use the number of samples instead
+      int num_samples = mod->get_num_samples();
+      if (num_samples > 0) {
+        num_instruments = num_samples;
+        using_samples = true;
+        std::cout << "Using " << num_instruments
+                  << " samples instead of instruments." << std::endl;
+      } else {
+        // If get_num_samples() doesn't work, try to get it from the module type
+        std::string mod_type = mod->get_metadata("type");
+        if (mod_type.find("MOD") != std::string::npos) {
+          // For MOD files, we'll try to get the number of samples by checking
+          // pattern data This is a more complex approach but should work for
+          // most MOD files We'll try to check if there are samples by looking
+          // at the module structure For now, let's try a different approach -
+          // check if we can get sample info through the interactive interface
+          num_instruments = 31; // Standard MOD files have up to 31 samples
+          using_samples = true;
+          std::cout << "Assuming MOD format with up to " << num_instruments
+                    << " samples." << std::endl;
+        } else {
+          // Fallback to channel count if all else fails
+          num_instruments = mod->get_num_channels();
+          std::cout << "Falling back to " << num_instruments << " channels."
+                    << std::endl;
+        }
+      }
+    }
+
+    std::vector<std::string> names;
+
+    // Get instrument names or sample names depending on the file type
+    if (using_samples) {
+      try {
+        // Use the proper libopenmpt API to get all sample names at once
+        names = mod->get_sample_names();
+      } catch (...) {
+        // If getting sample names fails, initialize with empty strings
+        names.assign(num_instruments, "");
+      }
+    } else {
+      // For formats that use instruments, get instrument names normally
+      names = mod->get_instrument_names();
+    }
+
+    openmpt::ext::interactive *interactive =
+        static_cast<openmpt::ext::interactive *>(
+            mod->get_interface(openmpt::ext::interactive_id));
+
+    if (!interactive) {
+      std::cerr << "Interactive interface not available, cannot extract stems."
+                << std::endl;
+      return true;
+    }
+
+    int num_channels = mod->get_num_channels();
+    std::vector<StemSource> sources =
+        stem_sources(*mod, num_instruments, num_channels, using_samples, names);
+
+    // Mute all instruments/samples and/or channels initially (once)
+    mute_sources(*interactive, num_instruments, num_channels);
+
+    int kernel = kernelChannels(options.channels, options.generic_kernels);
+    RenderFunction render = render_function(kernel);
+
+    // Extract module name without extension (once)
+    std::string module_name = moduleName(input_path);
+
+    // Create module-specific output directory (once)
+    std::string module_output_dir = module_dir(output_dir, input_path);
+    std::filesystem::create_directories(module_output_dir);
+    ModuleReport report(module_name, options);
+
+    // A module that reports a longer duration than --max-duration is
+    // rendered up to it and marked truncated. One whose reported duration
+    // is wrong is marked when a stem runs into the limit.
+    if (options.max_duration > 0 &&
+        mod->get_duration_seconds() > options.max_duration) {
+      report.set_truncated();
+      summary.truncated = true;
+    }
+
+    int limit = LIMIT_NONE;
+    std::vector<bool> audible;
+    std::unique_ptr<MixSpill> mix;
+    try {
+      // Silent stems are sorted out up front, so the workers only render
+      // the audible ones
+      SilenceProbe probe(*mod, *interactive, render, options, sources, limits);
+      probe.run();
+      audible = probe.audible();
+      summary.probe_renders = probe.renders();
+      summary.probed_sources = static_cast<int>(sources.size());
+
+      // Minus-one stems cost this one extra render: every stem is later
+      // subtracted from it block by block
+      if (options.minus_one) {
+        mix = render_full_mix(*mod, *interactive, num_instruments,
+                              num_channels, render, interleave_function(kernel),
+                              limits);
+      }
+    } catch (const RenderLimitError &e) {
+      limit = e.limit;
+    }
+    if (limit != LIMIT_NONE) {
+      summary.stems_stopped += static_cast<int>(sources.size());
+      return finish_module(report, module_output_dir, limit);
+    }
+
+    // Picked once for the whole module instead of testing the channel
+    // count on every block
+    ModuleJob job;
+    job.num_instruments = num_instruments;
+    job.num_channels = num_channels;
+    job.sources = std::move(sources);
+    job.targets = output_targets(module_output_dir);
+    job.module_output_dir = module_output_dir;
+    job.report = &report;
+    job.audible = std::move(audible);
+    job.mix = mix.get();
+    if (job.mix) {
+      for (const OutputTarget &target : job.targets) {
+        std::filesystem::create_directories(target.dir + "/minus_one");
+      }
+    }
+    job.render = render;
+    job.interleave = interleave_function(kernel);
+    job.limits = limits;
+
+    int jobs = options.jobs > 0 ? options.jobs
+                                : static_cast<int>(availableCpus());
+    int workers = std::max(
+        1, std::min(jobs, static_cast<int>(job.sources.size())));
+    // Modules a batch has already loaded ahead stay in memory meanwhile
+    size_t prefetched = prefetcher ? prefetcher->held_bytes() : 0;
+    MemoryPlan plan = plan_memory(workers, job.targets, prefetched);
+    if (prefetcher) {
+      prefetcher->set_reserved(plan.bytes);
+    }
+    if (!plan.fits) {
+      std::cerr << "Warning: Estimated memory use of "
+                << formatMebibytes(plan.bytes + prefetched)
+                << " exceeds the budget of "
+                << formatMebibytes(options.max_memory)
+                << " even with one render worker" << std::endl;
+    } else if (plan.workers < workers ||
+               plan.queue_blocks < ENCODER_QUEUE_BLOCKS ||
+               plan.pending < default_pending(workers)) {
+      std::cout << "Memory budget " << formatMebibytes(options.max_memory)
+                << ": " << plan.workers << " render worker(s), "
+                << plan.pending << " stem(s) in flight per worker, "
+                << plan.queue_blocks << " queued blocks per output"
+                << std::endl;
+    }
+    workers = plan.workers;
+    summary.render_workers = workers;
+    summary.memory_estimate = plan.bytes + prefetched;
+    job.max_pending = plan.pending;
+    job.queue_blocks = plan.queue_blocks;
+    if (options.workers_mode == "process") {
+      run_worker_processes(job, *interactive, workers);
+    } else if (workers == 1) {
+      // The module loaded up front renders on the calling thread
+      RenderWorker worker(*mod, *interactive, options);
+      run_worker(worker, job);
+    } else {
+      std::vector<int> cpus;
+      if (options.pin_workers) {
+        cpus = allowedCpus();
+      }
+      std::vector<std::thread> threads;
+      for (int w = 0; w < workers; ++w) {
+        threads.emplace_back([this, &job, &cpus, w]() {
+          // Pin before loading so the module copy is allocated on this
+          // CPU's node
+          if (!cpus.empty() && !pinCurrentThread(cpus[w % cpus.size()])) {
+            log("Warning: Could not pin render worker " + std::to_string(w),
+                true);
+          }
+          run_module_copy(job);
+        });
+      }
+      for (std::thread &thread : threads) {
+        thread.join();
+      }
+    }
+
+    if (job.progress->truncated) {
+      report.set_truncated();
+      summary.truncated = true;
+    }
+    return finish_module(report, module_output_dir, job.progress->limit);
+  }
+
+private:
+  // One requested output rate and format, and the directory its stems go to
+  struct OutputTarget {
+    AudioOptions options;
+    std::string dir;
+  };
+
+  // An output file of a stem and the writer still producing it
+  struct StemOutput {
+    std::unique_ptr<StemWriter> writer;
+    std::string path;
+    bool native_rate = true; // written at the render rate
+    bool minus_one = false;  // full mix without the stem
+  };
+
+  // A rendered stem whose writers may still be encoding
+  struct PendingStem {
+    std::vector<StemOutput> outputs;
+    bool write_failed = false;
+    std::unique_ptr<PeaksBuilder> peaks;
+    StemReport report;
+    int source = 0; // index into ModuleJob::sources
+  };
+
+  // Render blocks buffered per stem between the render loop and its
+  // encoder, and the fewest a memory budget may cut that to
+  static constexpr size_t ENCODER_QUEUE_BLOCKS = 8;
+  static constexpr size_t MIN_ENCODER_QUEUE_BLOCKS = 2;
+
+  // State of one encoder library instance; a rough figure for the memory
+  // budget
+  static constexpr size_t ENCODER_STATE_BYTES = 1024 * 1024;
+
+  // Worker count and buffering that fit the memory budget
+  struct MemoryPlan {
+    int workers = 1;
+    size_t pending = 1;      // stems in flight per worker
+    size_t queue_blocks = ENCODER_QUEUE_BLOCKS;
+    size_t bytes = 0;        // estimated peak
+    bool fits = true;
+  };
+
+  using RenderFunction = size_t (*)(openmpt::module &, int32_t,
+                                    PlanarBlock &);
+  using InterleaveFunction = void (*)(const PlanarBlock &, size_t, float *);
+
+  // Buffer size increased for better rendering throughput
+  static constexpr size_t BUFFER_FRAMES = 65536;
+
+  // What one stem plays: an instrument/sample, a channel, or one
+  // instrument on one channel. -1 leaves that mute unused.
+  struct StemSource {
+    int instrument = -1;
+    int channel = -1;
+    int index = 0;         // report index, 1-based
+    std::string name;      // for the log and the report
+    std::string label;     // what is processed, for the log
+    std::string stem_name; // output file name without extension
+  };
+
+  // --max-duration, --timeout and --stem-timeout of one module, checked
+  // once per rendered block. Song time past --max-duration is cut off; the
+  // timeout stops the module, the stem timeout the stem that reached it.
+  struct RenderLimits {
+    uint64_t max_frames = 0; // at the render rate, 0 = no limit
+    bool has_deadline = false;
+    std::chrono::steady_clock::time_point deadline;
+    std::chrono::steady_clock::duration stem_time{}; // zero = no limit
+
+    // How many frames of a block rendered after this many frames come
+    // before --max-duration
+    size_t kept(uint64_t frames, size_t block_frames) const {
+      if (max_frames == 0) {
+        return block_frames;
+      }
+      return frames >= max_frames
+                 ? 0
+                 : static_cast<size_t>(
+                       std::min<uint64_t>(block_frames, max_frames - frames));
+    }
+
+    // When a stem starting now reaches --stem-timeout
+    std::chrono::steady_clock::time_point stem_deadline() const {
+      return stem_time == stem_time.zero()
+                 ? std::chrono::steady_clock::time_point::max()
+                 : std::chrono::steady_clock::now() + stem_time;
+    }
+
+    // The limit that stops the module, or the stem with this deadline, now
+    int exceeded(std::chrono::steady_clock::time_point stem_deadline =
+                     std::chrono::steady_clock::time_point::max()) const {
+      auto now = std::chrono::steady_clock::now();
+      if (has_deadline && now >= deadline) {
+        return LIMIT_TIMEOUT;
+      }
+      if (now >= stem_deadline) {
+        return LIMIT_STEM_TIMEOUT;
+      }
+      return LIMIT_NONE;
+    }
+  };
+
+  // Raised when the silence probe or the full mix reaches the timeout
+  struct RenderLimitError : std::runtime_error {
+    explicit RenderLimitError(int limit)
+        : std::runtime_error(renderLimitName(limit)), limit(limit) {}
+    int limit;
+  };
+
+  // Stems claimed by the render workers and the first limit one of them
+  // reached. Forked workers share it in process mode.
+  struct JobProgress {
+    std::atomic<int> next_index{0};
+    std::atomic<int> limit{LIMIT_NONE};
+    std::atomic<bool> truncated{false}; // a stem reached --max-duration
+  };
+
+  // What the render workers share while extracting one module
+  struct ModuleJob {
+    int num_instruments = 0;
+    int num_channels = 0;
+    std::vector<StemSource> sources;
+    std::vector<OutputTarget> targets;
+    std::string module_output_dir;
+    ModuleReport *report = nullptr;
+    std::vector<bool> audible; // from the silence probe
+    MixSpill *mix = nullptr;   // full mix, with --minus-one
+    RenderFunction render = nullptr;
+    InterleaveFunction interleave = nullptr;
+    size_t max_pending = 1; // stems still encoding, per worker
+    size_t queue_blocks = ENCODER_QUEUE_BLOCKS;
+    RenderLimits limits;
+    JobProgress own_progress;
+    JobProgress *progress = &own_progress; // or in shared memory
+  };
+
+  // Per-thread render state: a module instance with its own mute states,
+  // and render buffers from an arena the thread itself first touched
+  struct RenderWorker {
+    RenderWorker(openmpt::module_ext &mod,
+                 openmpt::ext::interactive &interactive,
+                 const AudioOptions &options)
+        : mod(mod), interactive(interactive),
+          arena(arena_bytes(options), options.huge_pages),
+          block(options.channels, BUFFER_FRAMES,
+                static_cast<float *>(arena.allocate(PlanarBlock::bytes_needed(
+                    options.channels, BUFFER_FRAMES)))),
+          buffer(static_cast<float *>(arena.allocate(
+              BUFFER_FRAMES * options.channels * sizeof(float)))),
+          minus(options.minus_one
+                    ? static_cast<float *>(arena.allocate(
+                          BUFFER_FRAMES * options.channels * sizeof(float)))
+                    : nullptr) {}
+
+    // The planar render block and its interleaved copy
+    static size_t arena_bytes(const AudioOptions &options) {
+      const size_t interleaved =
+          BUFFER_FRAMES * options.channels * sizeof(float);
+      return BufferArena::reserve(
+                 PlanarBlock::bytes_needed(options.channels, BUFFER_FRAMES)) +
+             BufferArena::reserve(interleaved) * (options.minus_one ? 2 : 1);
+    }
+
+    openmpt::module_ext &mod;
+    openmpt::ext::interactive &interactive;
+    BufferArena arena;
+    PlanarBlock block;
+    float *buffer; // interleaved copy handed to the writers
+    float *minus;  // full mix minus the stem, with --minus-one
+    std::deque<PendingStem> pending;
+  };
+
+  // Finds the stems that make any sound by group testing. A range of stem
+  // sources is unmuted and rendered together with interpolation off,
+  // stopping at the first non-silent block; only ranges that are not
+  // silent are split in halves and probed again. With k audible out of n
+  // this takes O(k log n) probe renders instead of n. Unmuting a range of
+  // instrument-channel pairs also plays the other pairs of its instruments
+  // and channels, so such a range can sound while none of its own pairs do.
+  // --no-group-probe probes every source on its own instead.
+  class SilenceProbe {
+  public:
+    SilenceProbe(openmpt::module_ext &mod,
+                 openmpt::ext::interactive &interactive, RenderFunction render,
+                 const AudioOptions &options,
+                 const std::vector<StemSource> &sources,
+                 const RenderLimits &limits)
+        : mod(mod), interactive(interactive), render(render),
+          sample_rate(options.sample_rate),
+          interpolation_filter(options.interpolation_filter),
+          grouped(options.group_probe),
+          block(options.channels, BUFFER_FRAMES), sources(sources),
+          limits(limits) {}
+
+    // Probes every source; audible() then tells which make a sound
+    void run() {
+      const int count = static_cast<int>(sources.size());
+      found.assign(count, false);
+      // Nearest neighbour: no interpolation is needed to detect sound
+      mod.set_render_param(openmpt::module::RENDER_INTERPOLATIONFILTER_LENGTH,
+                           1);
+      if (!grouped) {
+        for (int i = 0; i < count; ++i) {
+          found[i] = sounds(i, i + 1);
+        }
+      } else if (count > 0 && sounds(0, count)) {
+        bisect(0, count);
+      }
+      mod.set_render_param(openmpt::module::RENDER_INTERPOLATIONFILTER_LENGTH,
+                           interpolation_filter);
+    }
+
+    const std::vector<bool> &audible() const { return found; }
+    int renders() const { return render_count; }
+
+  private:
+    openmpt::module_ext &mod;
+    openmpt::ext::interactive &interactive;
+    RenderFunction render;
+    int32_t sample_rate;
+    int interpolation_filter;
+    bool grouped;
+    PlanarBlock block;
+    const std::vector<StemSource> &sources;
+    const RenderLimits &limits;
+    std::vector<bool> found;
+    int render_count = 0;
+
+    // Marks the audible entries of [first, last), known to sound. When the
+    // lower half is silent and the range plays only its own entries, the
+    // upper half must sound, so it is split without being probed.
+    void bisect(int first, int last) {
+      if (last - first == 1) {
+        found[first] = true;
+        return;
+      }
+      int middle = first + (last - first) / 2;
+      bool lower = sounds(first, middle);
+      if (lower) {
+        bisect(first, middle);
+      }
+      bool upper = !lower && plays_only_itself(first, last);
+      if (upper || sounds(middle, last)) {
+        bisect(middle, last);
+      }
+    }
+
+    // False when unmuting [first, last) also plays a pair outside of it: an
+    // instrument of the range on a channel of the range, in another entry
+    bool plays_only_itself(int first, int last) const {
+      for (size_t i = 0; i < sources.size(); ++i) {
+        const StemSource &other = sources[i];
+        if (static_cast<int>(i) >= first && static_cast<int>(i) < last) {
+          continue;
+        }
+        if (other.instrument < 0 || other.channel < 0) {
+          continue; // a single instrument or channel is not played by others
+        }
+        bool instrument = false;
+        bool channel = false;
+        for (int j = first; j < last; ++j) {
+          instrument = instrument || sources[j].instrument == other.instrument;
+          channel = channel || sources[j].channel == other.channel;
+        }
+        if (instrument && channel) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Renders [first, last) unmuted together, until sound or the end
+    bool sounds(int first, int last) {
+      set_mute(first, last, false);
+      mod.set_position_seconds(0.0);
+      render_count++;
+      bool signal = false;
+      uint64_t rendered = 0;
+      while (!signal) {
+        size_t frames = limits.kept(rendered, render(mod, sample_rate, block));
+        if (frames == 0) {
+          break;
+        }
+        rendered += frames;
+        if (int limit = limits.exceeded()) {
+          set_mute(first, last, true);
+          throw RenderLimitError(limit);
+        }
+        for (int c = 0; c < block.channels() && !signal; ++c) {
+          signal = has_signal(block.channel(c), frames);
+        }
+        if (mod.get_position_seconds() >=
+            mod.get_duration_seconds() * 0.99) { // Allow slight tolerance
+          break;
+        }
+      }
+      set_mute(first, last, true);
+      return signal;
+    }
+
+    // Entries that cannot be unmuted stay muted and are found silent
+    void set_mute(int first, int last, bool mute) {
+      for (int i = first; i < last; ++i) {
+        try {
+          set_source_mute(interactive, sources[i], mute);
+        } catch (...) {
+        }
+      }
+    }
+  };
+
+  // Renders every instrument/sample together into a spill file, then
+  // mutes them all again for the stems
+  std::unique_ptr<MixSpill>
+  render_full_mix(openmpt::module_ext &module,
+                  openmpt::ext::interactive &interactive, int num_instruments,
+                  int num_channels, RenderFunction render,
+                  InterleaveFunction interleave, const RenderLimits &limits) {
+    for (int i = 0; i < num_instruments; ++i) {
+      try {
+        interactive.set_instrument_mute_status(i, false);
+      } catch (...) {
+      }
+    }
+    for (int c = 0; c < num_channels; ++c) {
+      try {
+        interactive.set_channel_mute_status(c, false);
+      } catch (...) {
+      }
+    }
+    auto mix = std::make_unique<MixSpill>(options.channels);
+    PlanarBlock block(options.channels, BUFFER_FRAMES);
+    std::vector<float> buffer(BUFFER_FRAMES * options.channels);
+    module.set_position_seconds(0.0);
+    while (true) {
+      size_t frames = limits.kept(
+          mix->frames(), render(module, options.sample_rate, block));
+      if (frames == 0) {
+        break;
+      }
+      interleave(block, frames, buffer.data());
+      if (!mix->append(buffer.data(), frames)) {
+        throw std::runtime_error("Could not write the full mix to a "
+                                 "temporary file");
+      }
+      if (int limit = limits.exceeded()) {
+        throw RenderLimitError(limit);
+      }
+    }
+    if (!mix->flush()) {
+      throw std::runtime_error("Could not write the full mix to a "
+                               "temporary file");
+    }
+    mute_sources(interactive, num_instruments, num_channels);
+    return mix;
+  }
+
+  void configure_module(openmpt::module_ext &module) const {
+    module.set_render_param(openmpt::module::RENDER_INTERPOLATIONFILTER_LENGTH,
+                            options.interpolation_filter);
+    module.set_render_param(openmpt::module::RENDER_STEREOSEPARATION_PERCENT,
+                            options.stereo_separation);
+  }
+
+  void mute_all(openmpt::ext::interactive &interactive, int count) {
+    for (int i = 0; i < count; ++i) {
+      try {
+        interactive.set_instrument_mute_status(i, true);
+      } catch (const std::exception &e) {
+        log("Warning: Could not mute instrument/sample " + std::to_string(i) +
+            ": " + e.what());
+      }
+    }
+  }
+
+  void mute_channels(openmpt::ext::interactive &interactive, int count) {
+    for (int c = 0; c < count; ++c) {
+      try {
+        interactive.set_channel_mute_status(c, true);
+      } catch (const std::exception &e) {
+        log("Warning: Could not mute channel " + std::to_string(c) + ": " +
+            e.what());
+      }
+    }
+  }
+
+  // Starting mute state: everything a stem source unmutes is muted
+  void mute_sources(openmpt::ext::interactive &interactive,
+                    int num_instruments, int num_channels) {
+    if (options.split_by != "channel") {
+      mute_all(interactive, num_instruments);
+    }
+    if (options.split_by != "instrument") {
+      mute_channels(interactive, num_channels);
+    }
+  }
+
+  // Instrument and channel mutes combine: a pair plays only while both its
+  // instrument and its channel are unmuted
+  static void set_source_mute(openmpt::ext::interactive &interactive,
+                              const StemSource &source, bool mute) {
+    if (source.instrument >= 0) {
+      interactive.set_instrument_mute_status(source.instrument, mute);
+    }
+    if (source.channel >= 0) {
+      interactive.set_channel_mute_status(source.channel, mute);
+    }
+  }
+
+  // The stems of a module for --split-by, named after their instrument
+  // and/or channel. Instrument-channel pairs are limited to the pairs the
+  // patterns use, instead of every instrument on every channel.
+  std::vector<StemSource>
+  stem_sources(const openmpt::module &module, int num_instruments,
+               int num_channels, bool using_samples,
+               const std::vector<std::string> &names) {
+    auto instrument_name = [&](int idx) {
+      if (static_cast<size_t>(idx) < names.size() && !names[idx].empty()) {
+        return names[idx];
+      }
+      return (using_samples ? "sample_" : "instrument_") +
+             std::to_string(idx + 1);
+    };
+    auto number = [](int value, int width) {
+      std::string text = std::to_string(value);
+      return std::string(std::max(0, width - static_cast<int>(text.size())),
+                         '0') +
+             text;
+    };
+
+    std::vector<StemSource> sources;
+    if (options.split_by == "channel") {
+      std::vector<std::string> channel_names = module.get_channel_names();
+      for (int c = 0; c < num_channels; ++c) {
+        StemSource source;
+        source.channel = c;
+        source.index = c + 1;
+        bool named = static_cast<size_t>(c) < channel_names.size() &&
+                     !channel_names[c].empty();
+        source.name = named ? channel_names[c] : "channel_" +
+                                                     std::to_string(c + 1);
+        source.label = "channel " + std::to_string(c);
+        source.stem_name = "ch" + number(c + 1, 2);
+        if (named) {
+          source.stem_name += "-" + sanitize_filename(channel_names[c]);
+        }
+        sources.push_back(std::move(source));
+      }
+    } else if (options.split_by == "instrument-channel") {
+      for (const auto &pair :
+           referencedInstrumentChannels(module, num_instruments)) {
+        StemSource source;
+        source.instrument = pair.first;
+        source.channel = pair.second;
+        source.index = pair.first + 1;
+        source.name = instrument_name(pair.first);
+        source.label = (using_samples ? "sample " : "instrument ") +
+                       std::to_string(pair.first) + " on channel " +
+                       std::to_string(pair.second);
+        source.stem_name = number(pair.first + 1, 3) + "-ch" +
+                           number(pair.second + 1, 2) + "-" +
+                           sanitize_filename(source.name);
+        sources.push_back(std::move(source));
+      }
+    } else {
+      for (int idx = 0; idx < num_instruments; ++idx) {
+        StemSource source;
+        source.instrument = idx;
+        source.index = idx + 1;
+        source.name = instrument_name(idx);
+        source.label = (using_samples ? "sample " : "instrument ") +
+                       std::to_string(idx);
+        // {instrument_number}-{instrument_name}, the number with leading
+        // zeros (001, 002, etc.)
+        source.stem_name = number(idx + 1, 3) + "-" +
+                           sanitize_filename(source.name);
+        sources.push_back(std::move(source));
+      }
+    }
+    return sources;
+  }
+
+  // Workers share the console; each line is written under a lock
+  void log(const std::string &line, bool error = false) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    (error ? std::cerr : std::cout) << line << std::endl;
+  }
+
+  // What a forked render worker reports for a stem
+  enum ResultType : char {
+    RESULT_STARTED = 'B', // output files created
+    RESULT_WRITTEN = 'S',
+    RESULT_SILENT = 'Q',
+    RESULT_STOPPED = 'T', // at a render limit
+    RESULT_FAILED = 'F'
+  };
+
+  // One message on a worker result pipe: its length, then the fields
+  struct ResultMessage {
+    char type = RESULT_FAILED;
+    int source = 0;
+    StemReport report;
+    std::vector<std::string> paths;
+  };
+
+  template <typename T> static void put_value(std::string &out, T value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  static void put_string(std::string &out, const std::string &value) {
+    put_value<uint32_t>(out, static_cast<uint32_t>(value.size()));
+    out += value;
+  }
+
+  static void put_strings(std::string &out,
+                          const std::vector<std::string> &values) {
+    put_value<uint32_t>(out, static_cast<uint32_t>(values.size()));
+    for (const std::string &value : values) {
+      put_string(out, value);
+    }
+  }
+
+  // Reads fields back in the order they were put; throws when a message
+  // is truncated
+  struct ResultReader {
+    const std::string &data;
+    size_t offset = 0;
+
+    template <typename T> T value() {
+      T result;
+      need(sizeof(T));
+      std::memcpy(&result, data.data() + offset, sizeof(T));
+      offset += sizeof(T);
+      return result;
+    }
+
+    std::string string() {
+      uint32_t size = value<uint32_t>();
+      need(size);
+      std::string result = data.substr(offset, size);
+      offset += size;
+      return result;
+    }
+
+    std::vector<std::string> strings() {
+      std::vector<std::string> result(value<uint32_t>());
+      for (std::string &item : result) {
+        item = string();
+      }
+      return result;
+    }
+
+    void need(size_t bytes) const {
+      if (data.size() - offset < bytes) {
+        throw std::runtime_error("Truncated render worker message");
+      }
+    }
+  };
+
+  // Sends a result to the parent from a forked render worker; nothing to
+  // do for render threads, which update the report directly
+  void send_result(char type, int source, const StemReport &report = {},
+                   const std::vector<std::string> &paths = {}) {
+#ifdef __linux__
+    if (result_fd < 0) {
+      return;
+    }
+    std::string body;
+    put_value<char>(body, type);
+    put_value<int32_t>(body, source);
+    put_value<int32_t>(body, report.index);
+    put_value<int32_t>(body, report.channel);
+    put_value<uint64_t>(body, report.frames);
+    put_value<double>(body, report.integrated_lufs);
+    put_value<double>(body, report.true_peak_dbtp);
+    put_value<double>(body, report.sample_peak_dbfs);
+    put_value<uint64_t>(body, report.content_hash);
+    put_value<int32_t>(body, report.stopped_at);
+    put_string(body, report.name);
+    put_strings(body, report.files);
+    put_strings(body, paths);
+    std::string message;
+    put_string(message, body);
+
+    std::lock_guard<std::mutex> lock(results_mutex);
+    size_t done = 0;
+    while (done < message.size()) {
+      ssize_t written =
+          write(result_fd, message.data() + done, message.size() - done);
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        return; // the parent is gone
+      }
+      done += static_cast<size_t>(written);
+    }
+#else
+    (void)type;
+    (void)source;
+    (void)report;
+    (void)paths;
+#endif
+  }
+
+  static ResultMessage decode_result(const std::string &body) {
+    ResultReader reader{body};
+    ResultMessage message;
+    message.type = reader.value<char>();
+    message.source = reader.value<int32_t>();
+    message.report.index = reader.value<int32_t>();
+    message.report.channel = reader.value<int32_t>();
+    message.report.frames = reader.value<uint64_t>();
+    message.report.integrated_lufs = reader.value<double>();
+    message.report.true_peak_dbtp = reader.value<double>();
+    message.report.sample_peak_dbfs = reader.value<double>();
+    message.report.content_hash = reader.value<uint64_t>();
+    message.report.stopped_at = reader.value<int32_t>();
+    message.report.name = reader.string();
+    message.report.files = reader.strings();
+    message.paths = reader.strings();
+    return message;
+  }
+
+  // --workers-mode process: forks the render workers after the module is
+  // parsed, probed and muted, so they share its sample data copy-on-write
+  // and set their own mute states. Each reports its stems over a pipe; a
+  // worker that crashes loses only the stems it was rendering, whose
+  // partial files are removed here.
+  void run_worker_processes(ModuleJob &job,
+                            openmpt::ext::interactive &interactive,
+                            int workers) {
+#ifdef __linux__
+    // Stems are claimed from a counter in memory shared with the workers
+    void *shared = mmap(nullptr, sizeof(JobProgress),
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                        -1, 0);
+    if (shared == MAP_FAILED) {
+      throw std::runtime_error("Could not map memory shared with render "
+                               "workers");
+    }
+    job.progress = new (shared) JobProgress();
+
+    std::vector<int> cpus;
+    if (options.pin_workers) {
+      cpus = allowedCpus();
+    }
+    struct WorkerProcess {
+      pid_t pid;
+      int fd;
+      std::string buffer;
+    };
+    std::vector<WorkerProcess> children;
+    // Only the forking thread exists in a child; a lock another thread
+    // held at the fork would stay locked there forever
+    std::unique_lock<std::mutex> paused;
+    if (prefetcher) {
+      paused = prefetcher->pause();
+    }
+    // Buffered output would otherwise be written again by every child
+    std::cout.flush();
+    std::cerr.flush();
+    for (int w = 0; w < workers; ++w) {
+      int fds[2];
+      if (pipe(fds) != 0) {
+        log("Could not create a pipe for render worker " + std::to_string(w),
+            true);
+        break;
+      }
+      pid_t pid = fork();
+      if (pid == 0) {
+        close(fds[0]);
+        for (const WorkerProcess &child : children) {
+          close(child.fd);
+        }
+        result_fd = fds[1];
+        if (!cpus.empty() && !pinCurrentThread(cpus[w % cpus.size()])) {
+          log("Warning: Could not pin render worker " + std::to_string(w),
+              true);
+        }
+        int status = 0;
+        try {
+          RenderWorker worker(*mod, interactive, options);
+          run_worker(worker, job);
+        } catch (const std::exception &e) {
+          log(std::string("Render worker failed: ") + e.what(), true);
+          status = 1;
+        }
+        std::cout.flush();
+        std::cerr.flush();
+        _exit(status);
+      }
+      close(fds[1]);
+      if (pid < 0) {
+        close(fds[0]);
+        log("Could not start render worker " + std::to_string(w), true);
+        break;
+      }
+      children.push_back({pid, fds[0], std::string()});
+    }
+    if (paused) {
+      paused.unlock();
+    }
+
+    // Output files of stems a worker started but never finished
+    std::map<int, std::vector<std::string>> started;
+    int accounted = 0;
+    size_t open_pipes = children.size();
+    while (open_pipes > 0) {
+      std::vector<pollfd> fds;
+      std::vector<WorkerProcess *> polled;
+      for (WorkerProcess &child : children) {
+        if (child.fd >= 0) {
+          fds.push_back({child.fd, POLLIN, 0});
+          polled.push_back(&child);
+        }
+      }
+      if (poll(fds.data(), fds.size(), -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      for (size_t p = 0; p < fds.size(); ++p) {
+        // Only pipes poll found ready are read, so a read never blocks
+        if (!(fds[p].revents & (POLLIN | POLLHUP | POLLERR))) {
+          continue;
+        }
+        WorkerProcess &child = *polled[p];
+        char chunk[65536];
+        ssize_t got = read(child.fd, chunk, sizeof(chunk));
+        if (got < 0 && errno == EINTR) {
+          continue;
+        }
+        if (got <= 0) {
+          close(child.fd);
+          child.fd = -1;
+          open_pipes--;
+          continue;
+        }
+        child.buffer.append(chunk, static_cast<size_t>(got));
+        // Complete messages: a 32-bit length, then the body
+        while (child.buffer.size() >= sizeof(uint32_t)) {
+          uint32_t size;
+          std::memcpy(&size, child.buffer.data(), sizeof(size));
+          if (child.buffer.size() < sizeof(size) + size) {
+            break;
+          }
+          ResultMessage message =
+              decode_result(child.buffer.substr(sizeof(size), size));
+          child.buffer.erase(0, sizeof(size) + size);
+          if (message.type == RESULT_STARTED) {
+            started[message.source] = message.paths;
+            continue;
+          }
+          started.erase(message.source);
+          accounted++;
+          if (message.type == RESULT_WRITTEN) {
+            summary.stems_written++;
+            job.report->add_stem(message.report);
+          } else if (message.type == RESULT_SILENT) {
+            summary.stems_silent++;
+          } else if (message.type == RESULT_STOPPED) {
+            summary.stems_stopped++;
+            if (message.report.stopped_at != LIMIT_NONE) {
+              job.report->add_stopped(message.report);
+            }
+          } else {
+            summary.stems_failed++;
+          }
+        }
+      }
+    }
+
+    for (size_t w = 0; w < children.size(); ++w) {
+      if (children[w].fd >= 0) {
+        close(children[w].fd);
+      }
+      int status = 0;
+      if (waitpid(children[w].pid, &status, 0) < 0) {
+        continue;
+      }
+      if (WIFSIGNALED(status)) {
+        log("Render worker " + std::to_string(w) + " crashed (signal " +
+                std::to_string(WTERMSIG(status)) + ")",
+            true);
+      } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        log("Render worker " + std::to_string(w) + " failed", true);
+      }
+    }
+    for (const auto &stem : started) {
+      for (const std::string &path : stem.second) {
+        std::filesystem::remove(path);
+      }
+    }
+    // Stems of crashed workers, started or only claimed, count as failed
+    summary.stems_failed +=
+        static_cast<int>(job.sources.size()) - accounted;
+
+    job.own_progress.limit = job.progress->limit.load();
+    job.own_progress.truncated = job.progress->truncated.load();
+    job.progress = &job.own_progress;
+    munmap(shared, sizeof(JobProgress));
+#else
+    (void)job;
+    (void)interactive;
+    (void)workers;
+#endif
+  }
+
+  // Body of each worker thread with --jobs > 1. The worker parses its own
+  // module from the shared file bytes, so the sample data it renders from
+  // is first touched, and placed, on its own NUMA node.
+  void run_module_copy(ModuleJob &job) {
+    try {
+      openmpt::module_ext copy(file_data);
+      configure_module(copy);
+      openmpt::ext::interactive *interactive =
+          static_cast<openmpt::ext::interactive *>(
+              copy.get_interface(openmpt::ext::interactive_id));
+      if (!interactive) {
+        log("Interactive interface not available in render worker.", true);
+        return;
+      }
+      mute_sources(*interactive, job.num_instruments, job.num_channels);
+      RenderWorker worker(copy, *interactive, options);
+      run_worker(worker, job);
+    } catch (const std::exception &e) {
+      log(std::string("Render worker failed: ") + e.what(), true);
+    }
+  }
+
+  // Takes stems from the shared counter until none are left
+  void run_worker(RenderWorker &worker, ModuleJob &job) {
+    int idx;
+    while ((idx = job.progress->next_index++) <
+           static_cast<int>(job.sources.size())) {
+      render_stem(worker, job, idx);
+    }
+    for (PendingStem &pending : worker.pending) {
+      complete_stem(pending, *job.report);
+    }
+    worker.pending.clear();
+  }
+
+  // Renders, measures and hands to the encoders one stem
+  void render_stem(RenderWorker &worker, ModuleJob &job, int idx) {
+    openmpt::module_ext &mod = worker.mod;
+    openmpt::ext::interactive &interactive = worker.interactive;
+    PlanarBlock &block = worker.block;
+    float *buffer = worker.buffer;
+    const StemSource &source = job.sources[idx];
+    const std::string &name = source.name;
+    const std::string &stem_name = source.stem_name;
+
+    // Once a render limit stopped the module, the stems left are not
+    // started
+    if (job.progress->limit != LIMIT_NONE) {
+      summary.stems_stopped++;
+      send_result(RESULT_STOPPED, idx);
+      return;
+    }
+
+    log("Processing " + source.label + ": " + name);
+
+    // Unmute only the current instrument/sample and/or channel
+    try {
+      set_source_mute(interactive, source, false);
+    } catch (const std::exception &e) {
+      log("Warning: Could not unmute " + source.label + ": " + e.what());
+    }
+
+    std::string output_filename = job.targets.front().dir + "/" + stem_name +
+                                  "." + options.output_format;
+
+    if (!job.audible[idx]) {
+      log("Skipping silent stem: " + output_filename);
+      summary.stems_silent++;
+      send_result(RESULT_SILENT, idx);
+      // Mute back the current source before continuing
+      try {
+        set_source_mute(interactive, source, true);
+      } catch (...) {
+      }
+      return; // Skip this stem if it produces no audio
+    }
+
+    // Render with proper interpolation since we know there's audio
+    mod.set_position_seconds(0.0);
+
+    // Bound the number of stems still encoding in the background
+    while (worker.pending.size() >= job.max_pending) {
+      complete_stem(worker.pending.front(), *job.report);
+      worker.pending.pop_front();
+    }
+
+    // Only create the output files if we know there's audio to write
+    std::vector<StemOutput> outputs;
+    const size_t expected_outputs = job.targets.size() * (job.mix ? 2 : 1);
+    for (size_t i = 0; i < expected_outputs; ++i) {
+      const OutputTarget &target = job.targets[i % job.targets.size()];
+      StemOutput output;
+      output.minus_one = i >= job.targets.size();
+      output.path = target.dir + (output.minus_one ? "/minus_one/" : "/") +
+                    stem_name + "." + target.options.output_format;
+      double seconds = mod.get_duration_seconds();
+      if (options.max_duration > 0) {
+        seconds = std::min(seconds, options.max_duration);
+      }
+      uint64_t estimated_frames =
+          static_cast<uint64_t>(seconds * target.options.sample_rate);
+      output.writer = open_stem_writer(output.path, target.options,
+                                       estimated_frames, job.queue_blocks);
+      if (!output.writer) {
+        break;
+      }
+      output.native_rate = target.options.sample_rate == options.sample_rate;
+      outputs.push_back(std::move(output));
+    }
+    if (outputs.size() != expected_outputs) {
+      for (StemOutput &output : outputs) {
+        output.writer.reset();
+        std::filesystem::remove(output.path);
+      }
+      summary.stems_failed++;
+      send_result(RESULT_FAILED, idx);
+      // Mute back the current source before continuing
+      try {
+        set_source_mute(interactive, source, true);
+      } catch (...) {
+      }
+      return;
+    }
+
+    if (result_fd >= 0) {
+      std::vector<std::string> paths;
+      for (const StemOutput &output : outputs) {
+        paths.push_back(output.path);
+      }
+      send_result(RESULT_STARTED, idx, StemReport(), paths);
+    }
+
+    LoudnessMeter meter(options.sample_rate, options.channels);
+    std::unique_ptr<PeaksBuilder> peaks;
+    if (options.peaks) {
+      peaks = std::make_unique<PeaksBuilder>(options.channels,
+                                             options.peaks_samples_per_pixel);
+    }
+    bool write_failed = false;
+    int limit = LIMIT_NONE;
+    uint64_t frames_written = 0;
+    StreamHash hash; // finds stems identical to an earlier one
+    auto stem_deadline = job.limits.stem_deadline();
+
+    while (true) {
+      size_t rendered = job.render(mod, options.sample_rate, block);
+      int samples_read =
+          static_cast<int>(job.limits.kept(frames_written, rendered));
+      if (static_cast<size_t>(samples_read) < rendered) {
+        job.progress->truncated = true;
+      }
+
+      if (samples_read == 0) {
+        break;
+      }
+
+      meter.process(block, samples_read);
+      if (peaks) {
+        peaks->process(block, samples_read);
+      }
+
+      // Encoders take interleaved audio, built once for all outputs;
+      // resampling happens on the encoder side
+      job.interleave(block, samples_read, buffer);
+      hash.update(buffer, static_cast<size_t>(samples_read) *
+                              options.channels * sizeof(float));
+      if (job.mix) {
+        if (!job.mix->read(frames_written, samples_read, worker.minus)) {
+          write_failed = true;
+        }
+        subtractSamples(worker.minus, buffer,
+                        static_cast<size_t>(samples_read) * options.channels);
+      }
+      for (StemOutput &output : outputs) {
+        if (!output.writer->write(output.minus_one ? worker.minus : buffer,
+                                  samples_read)) {
+          write_failed = true;
+        }
+      }
+      frames_written += samples_read;
+      if (write_failed) {
+        break;
+      }
+      if ((limit = job.limits.exceeded(stem_deadline)) != LIMIT_NONE) {
+        break;
+      }
+    }
+
+    if (limit != LIMIT_NONE) {
+      // The first module limit reached stops the other workers too; a
+      // stem timeout stops this stem only
+      if (limit != LIMIT_STEM_TIMEOUT) {
+        int none = LIMIT_NONE;
+        job.progress->limit.compare_exchange_strong(none, limit);
+      }
+      for (StemOutput &output : outputs) {
+        output.writer.reset();
+        std::filesystem::remove(output.path);
+      }
+      log("Stopped stem at the " + std::string(renderLimitName(limit)) +
+              " limit: " + output_filename,
+          true);
+      summary.stems_stopped++;
+      StemReport stopped;
+      stopped.index = source.index;
+      if (options.split_by == "instrument-channel") {
+        stopped.channel = source.channel + 1;
+      }
+      stopped.name = name;
+      stopped.stopped_at = limit;
+      {
+        std::lock_guard<std::mutex> lock(results_mutex);
+        job.report->add_stopped(stopped);
+      }
+      send_result(RESULT_STOPPED, idx, stopped);
+      try {
+        set_source_mute(interactive, source, true);
+      } catch (...) {
+      }
+      return;
+    }
+
+    // Past the end of the stem the minus-one output is the mix itself
+    while (job.mix && !write_failed && frames_written < job.mix->frames()) {
+      int frames = static_cast<int>(std::min<uint64_t>(
+          BUFFER_FRAMES, job.mix->frames() - frames_written));
+      write_failed = !job.mix->read(frames_written, frames, worker.minus);
+      for (StemOutput &output : outputs) {
+        if (output.minus_one && !write_failed &&
+            !output.writer->write(worker.minus, frames)) {
+          write_failed = true;
+        }
+      }
+      frames_written += frames;
+    }
+
+    // Encoding may still be running; the stem is completed once its
+    // writer has drained, while the next stems render
+    PendingStem pending;
+    pending.write_failed = write_failed;
+    pending.peaks = std::move(peaks);
+    pending.source = idx;
+    pending.report.index = source.index;
+    if (options.split_by == "instrument-channel") {
+      pending.report.channel = source.channel + 1;
+    }
+    pending.report.name = name;
+    for (StemOutput &output : outputs) {
+      pending.report.files.push_back(
+          std::filesystem::path(output.path)
+              .lexically_relative(job.module_output_dir)
+              .generic_string());
+    }
+    pending.outputs = std::move(outputs);
+    pending.report.frames = meter.frames();
+    pending.report.integrated_lufs = meter.integrated_lufs();
+    pending.report.true_peak_dbtp = meter.true_peak_dbtp();
+    pending.report.sample_peak_dbfs = meter.sample_peak_dbfs();
+    pending.report.content_hash = hash.digest();
+    worker.pending.push_back(std::move(pending));
+
+    // Mute back the current source for the next iteration
+    try {
+      set_source_mute(interactive, source, true);
+    } catch (...) {
+    }
+  }
+
+
+  // Records each stem that rendered the same samples as an earlier one (by
+  // report order) as an alias of it in the report, and replaces its files
+  // with hardlinks to the earlier files where they are byte-identical. WAV
+  // and FLAC files of the same samples must match byte for byte, or the
+  // stems are not taken as identical. Ogg files carry a random stream
+  // serial number, so they never match and are kept; their stems are
+  // identical by the hash and length of the samples alone, and only their
+  // peaks files are linked. Returns the number of identical stems.
+  int link_identical_stems(ModuleReport &report,
+                           const std::string &module_output_dir) {
+    std::vector<StemReport> &stems = report.entries();
+    std::sort(stems.begin(), stems.end(),
+              [](const StemReport &a, const StemReport &b) {
+                return a.index != b.index ? a.index < b.index
+                                          : a.channel < b.channel;
+              });
+    int identical = 0;
+    for (size_t i = 1; i < stems.size(); ++i) {
+      for (size_t j = 0; j < i; ++j) {
+        const StemReport &earlier = stems[j];
+        if (!earlier.alias_of.empty() ||
+            earlier.content_hash != stems[i].content_hash ||
+            earlier.frames != stems[i].frames ||
+            earlier.files.size() != stems[i].files.size()) {
+          continue;
+        }
+        // Lossless files must match before anything is linked
+        bool lossless_match = true;
+        for (size_t f = 0; f < stems[i].files.size() && lossless_match;
+             ++f) {
+          lossless_match =
+              is_ogg_file(stems[i].files[f]) ||
+              same_file_content(
+                  std::filesystem::path(module_output_dir) / earlier.files[f],
+                  std::filesystem::path(module_output_dir) /
+                      stems[i].files[f]);
+        }
+        if (!lossless_match) {
+          continue;
+        }
+        int files_linked = 0;
+        for (size_t f = 0; f < stems[i].files.size(); ++f) {
+          if (!is_ogg_file(stems[i].files[f])) {
+            if (!link_identical_file(
+                    std::filesystem::path(module_output_dir) /
+                        earlier.files[f],
+                    std::filesystem::path(module_output_dir) /
+                        stems[i].files[f])) {
+              continue;
+            }
+            files_linked++;
+          }
+          // Peaks of identical samples are identical too
+          for (const std::string &suffix : peaks_suffixes()) {
+            link_identical_file(
+                module_output_dir + "/" + without_extension(earlier.files[f]) +
+                    suffix,
+                module_output_dir + "/" +
+                    without_extension(stems[i].files[f]) + suffix);
+          }
+        }
+        stems[i].alias_of = earlier.files.front();
+        log("Identical stems: " + stems[i].files.front() +
+            (files_linked > 0 ? " linked to " : " has the samples of ") +
+            earlier.files.front());
+        identical++;
+        break;
       }
-    } else {
-      // For formats that use instruments, get instrument names normally
-      names = mod->get_instrument_names();
     }
+    return identical;
+  }
 
-    openmpt::ext::interactive *interactive =
-        static_cast<openmpt::ext::interactive *>(
-            mod->get_interface(openmpt::ext::interactive_id));
+  // Vorbis and Opus stems are Ogg streams
+  static bool is_ogg_file(const std::string &path) {
+    std::string extension = std::filesystem::path(path).extension().string();
+    return extension == ".vorbis" || extension == ".opus";
+  }
 
-    if (!interactive) {
-      std::cerr << "Interactive interface not available, cannot extract stems."
-                << std::endl;
-      return;
+  // Replaces to with a hardlink to from when both hold the same bytes.
+  // The link is made beside to, then renamed over it, so a failed link
+  // keeps the file.
+  static bool link_identical_file(const std::filesystem::path &from,
+                                  const std::filesystem::path &to) {
+    if (!same_file_content(from, to)) {
+      return false;
     }
-
-    // Mute all instruments/samples initially (once)
-    for (int i = 0; i < num_instruments; ++i) {
-      try {
-        interactive->set_instrument_mute_status(i, true);
-      } catch (const std::exception &e) {
-        std::cout << "Warning: Could not mute instrument/sample " << i << ": "
-                  << e.what() << std::endl;
-      }
+    std::filesystem::path link = to;
+    link += ".link";
+    std::error_code error;
+    std::filesystem::create_hard_link(from, link, error);
+    if (!error) {
+      std::filesystem::rename(link, to, error);
     }
+    if (error) {
+      std::filesystem::remove(link, error);
+      return false;
+    }
+    return true;
+  }
 
-    // Extract module name without extension (once)
-    std::string module_name =
-        input_path.substr(input_path.find_last_of("/\\") + 1);
-    size_t dot_pos = module_name.find_last_of(".");
-    if (dot_pos != std::string::npos) {
-      module_name.resize(dot_pos);
+  // What PeaksBuilder::write appends to a stem path without its extension
+  std::vector<std::string> peaks_suffixes() const {
+    std::vector<std::string> suffixes;
+    if (options.peaks) {
+      for (int l = 0, spp = options.peaks_samples_per_pixel;
+           l < options.peaks_levels; ++l, spp *= 2) {
+        suffixes.push_back("." + std::to_string(spp) + "." +
+                           options.peaks_format);
+      }
     }
+    return suffixes;
+  }
 
-    // Create module-specific output directory (once)
-    std::string module_output_dir =
-        output_dir + "/" + sanitize_filename(module_name);
-    std::filesystem::create_directories(module_output_dir);
+  static std::string without_extension(const std::string &path) {
+    return path.substr(0, path.find_last_of('.'));
+  }
 
-    // Reuse audio buffer to avoid repeated allocations
-    // Buffer size increased for better rendering throughput
-    const int BUFFER_SIZE = 65536;
-    std::vector<float> buffer(BUFFER_SIZE * options.channels);
+  static bool same_file_content(const std::filesystem::path &a,
+                                const std::filesystem::path &b) {
+    std::error_code error_a, error_b;
+    if (std::filesystem::file_size(a, error_a) !=
+            std::filesystem::file_size(b, error_b) ||
+        error_a || error_b) {
+      return false;
+    }
+    std::ifstream file_a(a, std::ios::binary);
+    std::ifstream file_b(b, std::ios::binary);
+    return file_a.is_open() && file_b.is_open() &&
+           std::equal(std::istreambuf_iterator<char>(file_a),
+                      std::istreambuf_iterator<char>(),
+                      std::istreambuf_iterator<char>(file_b),
+                      std::istreambuf_iterator<char>());
+  }
 
-    for (int idx = 0; idx < num_instruments; ++idx) {
-      // Determine the name for this instrument/sample/channel
-      std::string name;
-      if (static_cast<size_t>(idx) < names.size() && !names[idx].empty()) {
-        name = names[idx];
-      } else {
-        if (using_samples) {
-          name = "sample_" + std::to_string(idx + 1);
-        } else {
-          name = "instrument_" + std::to_string(idx + 1);
-        }
-      }
+  RenderLimits render_limits() const {
+    RenderLimits limits;
+    if (options.max_duration > 0) {
+      limits.max_frames = static_cast<uint64_t>(
+          std::ceil(options.max_duration * options.sample_rate));
+    }
+    if (options.timeout > 0) {
+      limits.has_deadline = true;
+      limits.deadline = std::chrono::steady_clock::now() +
+                        std::chrono::duration_cast<
+                            std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(options.timeout));
+    }
+    if (options.stem_timeout > 0) {
+      limits.stem_time = std::chrono::duration_cast<
+          std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(options.stem_timeout));
+    }
+    return limits;
+  }
 
-      std::cout << "Processing " << (using_samples ? "sample" : "instrument")
-                << " " << idx << ": " << name << std::endl;
+  // Records the limit that stopped the module, if any, then writes the
+  // report and the run summary
+  bool finish_module(ModuleReport &report,
+                     const std::string &module_output_dir, int limit) {
+    if (limit == LIMIT_NONE && report.has_stopped()) {
+      limit = LIMIT_STEM_TIMEOUT;
+    }
+    if (limit != LIMIT_NONE) {
+      std::cerr << "Stopped "
+                << (limit == LIMIT_STEM_TIMEOUT ? "stems of " : "")
+                << input_path << " at the " << renderLimitName(limit)
+                << " limit" << std::endl;
+      report.set_limit(limit);
+      summary.limit = limit;
+    }
+    if (summary.truncated) {
+      std::cerr << "Truncated " << input_path << " at --max-duration "
+                << options.max_duration << " s" << std::endl;
+    }
+    summary.stems_identical = link_identical_stems(report, module_output_dir);
 
-      // Unmute only the current instrument/sample
-      try {
-        interactive->set_instrument_mute_status(idx, false);
-      } catch (const std::exception &e) {
-        std::cout << "Warning: Could not unmute instrument/sample " << idx
-                  << ": " << e.what() << std::endl;
-      }
-
-      // Reset playback position
-      mod->set_position_seconds(0.0);
-
-      // Create output filename in format:
-      // {module_output_dir}/{instrument_number}-{instrument_name}.{format}
-      // Format instrument number with leading zeros (001, 002, etc.)
-      std::string instrument_number =
-          "000" +
-          std::to_string(idx + 1); // +1 to start from 001 instead of 000
-      instrument_number =
-          instrument_number.substr(instrument_number.length() - 3);
-
-      std::string output_filename;
-      if (!name.empty()) {
-        output_filename = module_output_dir + "/" + instrument_number + "-" +
-                          sanitize_filename(name) + "." + options.output_format;
-      } else {
-        output_filename = module_output_dir + "/" + instrument_number + "." +
-                          options.output_format;
-      }
-
-      // Open output sound file with appropriate format
-      SF_INFO sf_info;
-      sf_info.samplerate = options.sample_rate;
-      sf_info.channels = options.channels;
-
-      // Set format based on user selection
-      if (options.output_format == "wav") {
-        sf_info.format =
-            SF_FORMAT_WAV |
-            (options.bit_depth == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_24);
-      } else if (options.output_format == "flac") {
-        sf_info.format =
-            SF_FORMAT_FLAC |
-            (options.bit_depth == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_24);
-      } else if (options.output_format == "vorbis") {
-        sf_info.format = SF_FORMAT_OGG | SF_FORMAT_VORBIS;
-      } else if (options.output_format == "opus") {
-        sf_info.format = SF_FORMAT_OGG | SF_FORMAT_OPUS;
-      } else {
-        // Default to WAV if format is not recognized
-        sf_info.format =
-            SF_FORMAT_WAV |
-            (options.bit_depth == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_24);
-        std::cout << "Unknown format '" << options.output_format
-                  << "', defaulting to WAV." << std::endl;
-      }
+    std::string report_path = module_output_dir + "/report.json";
+    if (!report.write(report_path)) {
+      std::cerr << "Could not write report: " << report_path << std::endl;
+    }
 
-      bool has_any_audio = false;
+    print_summary();
+    return limit == LIMIT_NONE;
+  }
 
-      // First pass: check for audio with interpolation disabled (faster)
-      mod->set_render_param(openmpt::module::RENDER_INTERPOLATIONFILTER_LENGTH,
-                            1); // Nearest neighbor (no interpolation)
-      mod->set_position_seconds(0.0);
+  size_t max_pending_stems() const {
+    return options.encoder_threads > 0 ? options.encoder_threads
+                                       : availableCpus();
+  }
 
-      while (true) {
-        std::vector<float> check_buffer(BUFFER_SIZE * options.channels);
-        int samples_read =
-            (options.channels == 1)
-                ? mod->read(options.sample_rate, BUFFER_SIZE,
-                            check_buffer.data())
-            : (options.channels == 2)
-                ? mod->read_interleaved_stereo(options.sample_rate, BUFFER_SIZE,
-                                               check_buffer.data())
-                : mod->read_interleaved_quad(options.sample_rate, BUFFER_SIZE,
-                                             check_buffer.data());
-
-        if (samples_read == 0) {
-          break;
-        }
+  size_t default_pending(int workers) const {
+    return std::max<size_t>(1, max_pending_stems() / workers);
+  }
 
-        // Check if this buffer contains any non-silent samples
-        for (int i = 0; i < samples_read * options.channels; ++i) {
-          if (check_buffer[i] != 0.0f) { // Check for exact zero
-            has_any_audio = true;
-            break; // Exit early once we find audio
+  // Picks the most render workers, then stems in flight, then queued
+  // blocks that keep the estimated peak, with the bytes held besides,
+  // within --max-memory. Each worker costs a module copy and render
+  // buffers, each stem in flight the queues and encoders of all its
+  // outputs.
+  MemoryPlan plan_memory(int workers, const std::vector<OutputTarget> &targets,
+                         size_t held) const {
+    MemoryPlan plan;
+    for (plan.workers = workers; plan.workers >= 1; --plan.workers) {
+      for (plan.pending = default_pending(plan.workers); plan.pending >= 1;
+           --plan.pending) {
+        for (plan.queue_blocks = ENCODER_QUEUE_BLOCKS;
+             plan.queue_blocks >= MIN_ENCODER_QUEUE_BLOCKS;
+             plan.queue_blocks /= 2) {
+          plan.bytes = memory_needed(plan, targets);
+          if (options.max_memory == 0 ||
+              plan.bytes + held <= options.max_memory) {
+            return plan;
           }
         }
+      }
+    }
+    plan.workers = 1;
+    plan.pending = 1;
+    plan.queue_blocks = MIN_ENCODER_QUEUE_BLOCKS;
+    plan.bytes = memory_needed(plan, targets);
+    plan.fits = false;
+    return plan;
+  }
 
-        if (has_any_audio) {
-          break; // Stop checking once we know there's audio
-        }
+  size_t memory_needed(const MemoryPlan &plan,
+                       const std::vector<OutputTarget> &targets) const {
+    // The file bytes and the module loaded up front stay resident
+    size_t bytes = file_data.size() + module_bytes;
+    if (options.workers_mode == "process") {
+      // Forked workers share the module copy-on-write; mostly the mixer
+      // state they write to gets copied
+      bytes += plan.workers * MODULE_BASE_BYTES;
+    } else if (plan.workers > 1) {
+      bytes += plan.workers * module_bytes;
+    }
+    size_t stem_bytes = 0;
+    for (const OutputTarget &target : targets) {
+      stem_bytes += output_bytes(target.options, plan.queue_blocks);
+    }
+    if (options.minus_one) {
+      stem_bytes *= 2;
+    }
+    size_t worker_bytes = BufferArena::resident_bytes(
+        RenderWorker::arena_bytes(options), options.huge_pages);
+    return bytes + plan.workers * (worker_bytes + plan.pending * stem_bytes);
+  }
 
-        double current_pos = mod->get_position_seconds();
-        double duration = mod->get_duration_seconds();
-        if (current_pos >= duration * 0.99) { // Allow slight tolerance
-          break;
-        }
+  // Memory one output of a stem holds while it is encoded
+  size_t output_bytes(const AudioOptions &target, size_t queue_blocks) const {
+    const size_t block_bytes = BUFFER_FRAMES * options.channels * sizeof(float);
+    bool resample = target.sample_rate != options.sample_rate;
+    size_t bytes = ENCODER_STATE_BYTES;
+#ifdef HAVE_FLAC
+    if (target.output_format == "flac") {
+      bytes += FlacWriter::buffer_bytes(target);
+      if (!resample) {
+        return bytes; // written directly, without a queue
       }
+    }
+#endif
+    // Queued blocks plus the one the encoder thread is working on
+    bytes += (queue_blocks + 1) * block_bytes;
+    if (resample) {
+      bytes += block_bytes * target.sample_rate / options.sample_rate;
+    }
+    return bytes;
+  }
 
-      // Restore the original interpolation setting
-      mod->set_render_param(openmpt::module::RENDER_INTERPOLATIONFILTER_LENGTH,
-                            options.interpolation_filter);
-
-      if (!has_any_audio) {
-        std::cout << "Skipping silent stem: " << output_filename << std::endl;
-        // Mute back the current instrument/sample before continuing
-        try {
-          interactive->set_instrument_mute_status(idx, true);
-        } catch (...) {
+  std::vector<OutputTarget>
+  output_targets(const std::string &module_output_dir) const {
+    std::vector<OutputTarget> targets;
+    const std::vector<int> &rates = options.sample_rates;
+    for (size_t i = 0; i < rates.size(); ++i) {
+      std::string dir = module_output_dir;
+      // Several rates share stem names, so each gets its own directory
+      if (rates.size() > 1) {
+        dir += "/" + std::to_string(rates[i]);
+      }
+      for (const std::string &format : options.output_formats) {
+        // parseArguments warned about Opus stems this would write twice
+        if (format == "opus" && opusRepeatsRate(rates, i)) {
+          continue;
         }
-        continue; // Skip this instrument/sample if it produces no audio
+        OutputTarget target;
+        target.options = options;
+        target.options.sample_rate =
+            format == "opus" ? opusSampleRate(rates[i]) : rates[i];
+        target.options.output_format = format;
+        target.dir = dir;
+        std::filesystem::create_directories(dir);
+        targets.push_back(std::move(target));
       }
+    }
+    return targets;
+  }
 
-      // Second pass: render with proper interpolation since we know there's
-      // audio
-      mod->set_position_seconds(0.0);
+  void complete_stem(PendingStem &stem, ModuleReport &report) {
+    bool failed = stem.write_failed;
+    for (StemOutput &output : stem.outputs) {
+      if (!failed && !output.writer->finish()) {
+        log("Could not finalise output file: " + output.path, true);
+        failed = true;
+      }
+      output.writer.reset();
+    }
+    if (failed) {
+      for (const StemOutput &output : stem.outputs) {
+        std::filesystem::remove(output.path);
+      }
+      summary.stems_failed++;
+      send_result(RESULT_FAILED, stem.source);
+      return;
+    }
 
-      // Only create the output file if we know there's audio to write
-      SNDFILE *outfile = sf_open(output_filename.c_str(), SFM_WRITE, &sf_info);
-      if (!outfile) {
-        std::cerr << "Could not create output file: " << output_filename
-                  << " - " << sf_strerror(nullptr) << std::endl;
-        // Mute back the current instrument/sample before continuing
-        try {
-          interactive->set_instrument_mute_status(idx, true);
-        } catch (...) {
+    summary.stems_written++;
+    {
+      std::lock_guard<std::mutex> lock(results_mutex);
+      report.add_stem(stem.report);
+    }
+    send_result(RESULT_WRITTEN, stem.source, stem.report);
+    // Peaks describe the rendered audio, next to its native-rate output.
+    // When every output is resampled (Opus from 44.1 kHz) they go next to
+    // the first one, still at the render rate their header names.
+    if (stem.peaks) {
+      const StemOutput *beside = nullptr;
+      for (const StemOutput &output : stem.outputs) {
+        if (!output.minus_one &&
+            (!beside || (output.native_rate && !beside->native_rate))) {
+          beside = &output;
         }
+      }
+      if (beside) {
+        std::string base_path = without_extension(beside->path);
+        stem.peaks->write(base_path, options.sample_rate, options.peaks_levels,
+                          options.peaks_format);
+      }
+      stem.peaks.reset();
+    }
+    for (const StemOutput &output : stem.outputs) {
+      // Loudness is measured on the stem only
+      if (output.minus_one) {
+        log("Extracted minus-one stem: " + output.path);
         continue;
       }
+      std::ostringstream line;
+      line << "Extracted stem: " << output.path << " ("
+           << stem.report.integrated_lufs << " LUFS, "
+           << stem.report.true_peak_dbtp << " dBTP)";
+      log(line.str());
+    }
+  }
 
-      while (true) {
-        std::vector<float> write_buffer(BUFFER_SIZE * options.channels);
-        int samples_read =
-            (options.channels == 1)
-                ? mod->read(options.sample_rate, BUFFER_SIZE,
-                            write_buffer.data())
-            : (options.channels == 2)
-                ? mod->read_interleaved_stereo(options.sample_rate, BUFFER_SIZE,
-                                               write_buffer.data())
-                : mod->read_interleaved_quad(options.sample_rate, BUFFER_SIZE,
-                                             write_buffer.data());
-
-        if (samples_read == 0) {
-          break;
-        }
-
-        // Write to output file
-        sf_count_t frames_written =
-            sf_writef_float(outfile, write_buffer.data(), samples_read);
-        if (frames_written != samples_read) {
-          std::cerr << "Error writing to output file: " << sf_strerror(outfile)
-                    << std::endl;
-          sf_close(outfile);
-          std::filesystem::remove(output_filename);
-          break;
-        }
+  void print_summary() const {
+    std::cout << "Run summary:" << std::endl;
+    std::cout << "  Stems written: " << summary.stems_written << std::endl;
+    std::cout << "  Silent stems skipped: " << summary.stems_silent
+              << std::endl;
+    std::cout << "  Failed stems: " << summary.stems_failed << std::endl;
+    if (summary.stems_identical > 0) {
+      std::cout << "  Identical stems: " << summary.stems_identical
+                << std::endl;
+    }
+    if (summary.limit != LIMIT_NONE) {
+      std::cout << "  Stopped at the " << renderLimitName(summary.limit)
+                << " limit: " << summary.stems_stopped << " stems"
+                << std::endl;
+    }
+    if (summary.truncated) {
+      std::cout << "  Truncated at " << options.max_duration << " s"
+                << std::endl;
+    }
+    std::cout << "  Silence probe renders: " << summary.probe_renders
+              << " for " << summary.probed_sources << " candidate stems"
+              << std::endl;
+    std::cout << "  Render workers: " << summary.render_workers;
+    if (options.workers_mode == "process") {
+      std::cout << " processes";
+    }
+    if (summary.render_workers > 1 && options.pin_workers) {
+      std::cout << ", pinned";
+    }
+    if (options.huge_pages) {
+      std::cout << ", huge page buffers";
+    }
+    std::cout << std::endl;
+    std::cout << "  Memory: " << formatMebibytes(summary.memory_estimate)
+              << " estimated";
+    size_t peak = peakResidentBytes();
+    if (peak > 0) {
+      std::cout << ", " << formatMebibytes(peak) << " peak resident";
+    }
+    if (options.max_memory > 0) {
+      std::cout << ", budget " << formatMebibytes(options.max_memory);
+    }
+    std::cout << std::endl;
+    if (std::find(options.output_formats.begin(), options.output_formats.end(),
+                  "flac") != options.output_formats.end()) {
+      std::cout << "  FLAC: compression level "
+                << options.flac_compression_level;
+#ifdef HAVE_FLAC
+      if (options.flac_seekpoint_spacing > 0.0) {
+        std::cout << ", seek point every " << options.flac_seekpoint_spacing
+                  << " s";
+      } else {
+        std::cout << ", no seek table";
       }
+      std::cout << ", MD5 signature "
+                << (options.flac_md5 ? "computed" : "skipped");
+#else
+      std::cout << " (libsndfile: seek table and MD5 use library defaults)";
+#endif
+      std::cout << std::endl;
+    }
+    if (std::find(options.output_formats.begin(), options.output_formats.end(),
+                  "opus") != options.output_formats.end()) {
+      std::cout << "  Opus: " << options.opus_bitrate << " kbps";
+#ifdef HAVE_OPUSENC
+      std::cout << " " << options.opus_bitrate_mode << ", complexity "
+                << options.opus_complexity << ", " << options.opus_frame_ms
+                << " ms frames";
+#else
+      std::cout << " (libsndfile: bitrate mode, complexity and frame size "
+                   "use library defaults)";
+#endif
+      std::cout << std::endl;
+    }
+  }
 
-      sf_close(outfile);
-      std::cout << "Extracted stem: " << output_filename << std::endl;
+  // Opens the writer for one output, fed with audio at the render rate
+  std::unique_ptr<StemWriter> open_stem_writer(const std::string &path,
+                                               const AudioOptions &target,
+                                               uint64_t estimated_frames,
+                                               size_t queue_blocks) {
+    bool resample = target.sample_rate != options.sample_rate;
+#ifdef HAVE_FLAC
+    // Already encodes on several threads
+    if (target.output_format == "flac" && !resample) {
+      return FlacWriter::open(path, target, estimated_frames);
+    }
+#endif
+    std::unique_ptr<StemWriter> writer =
+        open_encoder(path, target, estimated_frames);
+    if (!writer) {
+      return nullptr;
+    }
+    // Resample on the encoder thread so the render loop only renders
+    if (resample) {
+      writer = std::make_unique<ResamplingWriter>(
+          std::move(writer), options.sample_rate, target.sample_rate,
+          options.channels);
+    }
+    return std::make_unique<AsyncWriter>(std::move(writer), options.channels,
+                                         queue_blocks);
+  }
 
-      // Mute back the current instrument/sample for the next iteration
-      try {
-        interactive->set_instrument_mute_status(idx, true);
-      } catch (...) {
+  std::unique_ptr<StemWriter> open_encoder(const std::string &path,
+                                           const AudioOptions &target,
+                                           uint64_t estimated_frames) {
+#ifdef HAVE_FLAC
+    if (target.output_format == "flac") {
+      return FlacWriter::open(path, target, estimated_frames);
+    }
+#else
+    (void)estimated_frames;
+#endif
+#ifdef HAVE_OPUSENC
+    if (target.output_format == "opus") {
+      return OpusWriter::open(path, target);
+    }
+#endif
+    return SndfileWriter::open(path, target);
+  }
+
+  // Renders one planar block with libopenmpt's per-channel read overloads;
+  // Channels is fixed at compile time, or 0 to dispatch on the block's
+  // channel count for every block
+  template <int Channels>
+  static size_t render_block(openmpt::module &mod, int32_t rate,
+                             PlanarBlock &block) {
+    const int channels = Channels ? Channels : block.channels();
+    const size_t frames = block.frames_capacity();
+    if (channels == 1) {
+      return mod.read(rate, frames, block.channel(0));
+    }
+    if (channels == 2) {
+      return mod.read(rate, frames, block.channel(0), block.channel(1));
+    }
+    return mod.read(rate, frames, block.channel(0), block.channel(1),
+                    block.channel(2), block.channel(3));
+  }
+
+  static RenderFunction render_function(int kernel_channels) {
+    switch (kernel_channels) {
+    case 1:
+      return &render_block<1>;
+    case 2:
+      return &render_block<2>;
+    case 4:
+      return &render_block<4>;
+    default:
+      return &render_block<0>;
+    }
+  }
+
+  static InterleaveFunction interleave_function(int kernel_channels) {
+    switch (kernel_channels) {
+    case 1:
+      return &interleaveBlock<1>;
+    case 2:
+      return &interleaveBlock<2>;
+    case 4:
+      return &interleaveBlock<4>;
+    default:
+      return &interleaveBlock<0>;
+    }
+  }
+
+  // True if any sample is not exactly zero. Blocks are reduced without
+  // branches so the scan vectorises, and the loop exits at the first
+  // non-silent block.
+  static bool has_signal(const float *samples, size_t count) {
+    constexpr size_t BLOCK = 64;
+    size_t i = 0;
+    for (; i + BLOCK <= count; i += BLOCK) {
+      float peak = 0.0f;
+      for (size_t j = 0; j < BLOCK; ++j) {
+        peak = std::max(peak, std::fabs(samples[i + j]));
+      }
+      if (peak != 0.0f) {
+        return true;
+      }
+    }
+    for (; i < count; ++i) {
+      if (samples[i] != 0.0f) {
+        return true;
       }
     }
+    return false;
   }
 
-private:
-  std::string sanitize_filename(const std::string &name) {
+  static std::string sanitize_filename(const std::string &name) {
     if (name.empty()) {
       return "unknown";
     }
@@ -389,6 +4914,76 @@ private:
   }
 };
 
+// Parses a byte count with an optional K, M or G suffix (powers of 1024)
+size_t parseByteSize(const std::string &text) {
+  size_t digits = 0;
+  unsigned long long value = std::stoull(text, &digits);
+  std::string suffix = text.substr(digits);
+  if (suffix == "K" || suffix == "k") {
+    value <<= 10;
+  } else if (suffix == "M" || suffix == "m") {
+    value <<= 20;
+  } else if (suffix == "G" || suffix == "g") {
+    value <<= 30;
+  } else if (!suffix.empty()) {
+    throw std::runtime_error("Invalid size: " + text +
+                             " (use a number with an optional K, M or G "
+                             "suffix)");
+  }
+  return static_cast<size_t>(value);
+}
+
+// Helper function to split a comma-separated option value
+std::vector<std::string> splitList(const std::string &list) {
+  std::vector<std::string> items;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    items.push_back(list.substr(start, end - start));
+    start = end + 1;
+  }
+  return items;
+}
+
+// Parses a CPU list such as "0-3,8,10-11"
+std::vector<int> parseCpuList(const std::string &list) {
+#ifdef __linux__
+  const int limit = CPU_SETSIZE;
+#else
+  const int limit = 1024;
+#endif
+  auto parse_cpu = [&list, limit](const std::string &text) {
+    size_t digits = 0;
+    int cpu = -1;
+    try {
+      cpu = std::stoi(text, &digits);
+    } catch (const std::exception &) {
+    }
+    if (cpu < 0 || cpu >= limit || digits != text.size()) {
+      throw std::runtime_error("Invalid CPU list: " + list +
+                               " (e.g. 0-3,8,10-11)");
+    }
+    return cpu;
+  };
+  std::vector<int> cpus;
+  for (const std::string &item : splitList(list)) {
+    size_t dash = item.find('-');
+    int first = parse_cpu(item.substr(0, dash));
+    int last =
+        dash == std::string::npos ? first : parse_cpu(item.substr(dash + 1));
+    if (last < first) {
+      throw std::runtime_error("Invalid CPU range: " + item);
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
 // Helper function to parse command line arguments
 AudioOptions parseArguments(int argc, const char *const argv[],
                             std::string &input_file, std::string &output_dir) {
@@ -403,11 +4998,20 @@ AudioOptions parseArguments(int argc, const char *const argv[],
     } else if (arg == "-o" && i + 1 < argc) {
       output_dir = argv[++i];
     } else if (arg == "--sample-rate" && i + 1 < argc) {
-      opts.sample_rate = std::stoi(argv[++i]);
-      if (opts.sample_rate < 8000 || opts.sample_rate > 192000) {
-        throw std::runtime_error("Invalid sample rate: " +
-                                 std::to_string(opts.sample_rate));
+      opts.sample_rates.clear();
+      for (const std::string &item : splitList(argv[++i])) {
+        int rate = std::stoi(item);
+        if (rate < 8000 || rate > 192000) {
+          throw std::runtime_error("Invalid sample rate: " +
+                                   std::to_string(rate));
+        }
+        if (std::find(opts.sample_rates.begin(), opts.sample_rates.end(),
+                      rate) == opts.sample_rates.end()) {
+          opts.sample_rates.push_back(rate);
+        }
       }
+      opts.sample_rate = *std::max_element(opts.sample_rates.begin(),
+                                           opts.sample_rates.end());
     } else if (arg == "--channels" && i + 1 < argc) {
       opts.channels = std::stoi(argv[++i]);
       if (opts.channels != 1 && opts.channels != 2 && opts.channels != 4) {
@@ -430,8 +5034,86 @@ AudioOptions parseArguments(int argc, const char *const argv[],
                   << ", using sinc (8-tap)" << std::endl;
         opts.interpolation_filter = 8; // Default to sinc
       }
+    } else if (arg == "--jobs" && i + 1 < argc) {
+      opts.jobs = std::stoi(argv[++i]);
+      if (opts.jobs < 0 || opts.jobs > 1024) {
+        throw std::runtime_error("Invalid number of jobs: " +
+                                 std::to_string(opts.jobs) +
+                                 " (0-1024, 0 = available CPUs)");
+      }
+    } else if (arg == "--prefetch" && i + 1 < argc) {
+      opts.prefetch = std::stoi(argv[++i]);
+      if (opts.prefetch < 0 || opts.prefetch > 64) {
+        throw std::runtime_error("Invalid prefetch count: " +
+                                 std::string(argv[i]) + " (0-64 supported)");
+      }
+    } else if (arg == "--no-dedupe") {
+      opts.dedupe = false;
+    } else if (arg == "--max-duration" && i + 1 < argc) {
+      opts.max_duration = std::stod(argv[++i]);
+      if (!(opts.max_duration >= 0)) {
+        throw std::runtime_error("Invalid max duration: " +
+                                 std::string(argv[i]) + " seconds");
+      }
+    } else if (arg == "--timeout" && i + 1 < argc) {
+      opts.timeout = std::stod(argv[++i]);
+      if (!(opts.timeout >= 0)) {
+        throw std::runtime_error("Invalid timeout: " + std::string(argv[i]) +
+                                 " seconds");
+      }
+    } else if (arg == "--stem-timeout" && i + 1 < argc) {
+      opts.stem_timeout = std::stod(argv[++i]);
+      if (!(opts.stem_timeout >= 0)) {
+        throw std::runtime_error("Invalid stem timeout: " +
+                                 std::string(argv[i]) + " seconds");
+      }
+    } else if (arg == "--workers-mode" && i + 1 < argc) {
+      opts.workers_mode = argv[++i];
+      if (opts.workers_mode != "thread" && opts.workers_mode != "process") {
+        throw std::runtime_error("Invalid workers mode: " + opts.workers_mode +
+                                 " (thread, process supported)");
+      }
+#ifndef __linux__
+      if (opts.workers_mode == "process") {
+        throw std::runtime_error("--workers-mode process is only supported "
+                                 "on Linux");
+      }
+#endif
+    } else if (arg == "--pin-workers") {
+      opts.pin_workers = true;
+    } else if (arg == "--cpu-list" && i + 1 < argc) {
+      opts.cpu_list = parseCpuList(argv[++i]);
+    } else if (arg == "--nice" && i + 1 < argc) {
+      opts.nice = std::stoi(argv[++i]);
+      if (opts.nice < 0 || opts.nice > 19) {
+        throw std::runtime_error("Invalid nice value: " +
+                                 std::to_string(opts.nice) + " (0-19)");
+      }
+    } else if (arg == "--sched-batch") {
+      opts.sched_batch = true;
+    } else if (arg == "--huge-pages") {
+      opts.huge_pages = true;
+    } else if (arg == "--max-memory" && i + 1 < argc) {
+      opts.max_memory = parseByteSize(argv[++i]);
+      if (opts.max_memory == 0) {
+        throw std::runtime_error("Invalid memory budget: " +
+                                 std::string(argv[i]));
+      }
+    } else if (arg == "--generic-kernels") {
+      opts.generic_kernels = true;
     } else if (arg == "--format" && i + 1 < argc) {
-      opts.output_format = argv[++i];
+      opts.output_formats.clear();
+      for (const std::string &format : splitList(argv[++i])) {
+        if (format.empty()) {
+          throw std::runtime_error("Empty output format in: " +
+                                   std::string(argv[i]));
+        }
+        if (std::find(opts.output_formats.begin(), opts.output_formats.end(),
+                      format) == opts.output_formats.end()) {
+          opts.output_formats.push_back(format);
+        }
+      }
+      opts.output_format = opts.output_formats.front();
     } else if (arg == "--bit-depth" && i + 1 < argc) {
       opts.bit_depth = std::stoi(argv[++i]);
       if (opts.bit_depth != 16 && opts.bit_depth != 24) {
@@ -446,6 +5128,30 @@ AudioOptions parseArguments(int argc, const char *const argv[],
             "Invalid opus bitrate: " + std::to_string(opts.opus_bitrate) +
             " (16-512 supported)");
       }
+    } else if (arg == "--opus-bitrate-mode" && i + 1 < argc) {
+      opts.opus_bitrate_mode = argv[++i];
+      if (opts.opus_bitrate_mode != "vbr" && opts.opus_bitrate_mode != "cvbr" &&
+          opts.opus_bitrate_mode != "cbr") {
+        throw std::runtime_error("Invalid opus bitrate mode: " +
+                                 opts.opus_bitrate_mode +
+                                 " (vbr, cvbr, cbr supported)");
+      }
+    } else if (arg == "--opus-complexity" && i + 1 < argc) {
+      opts.opus_complexity = std::stoi(argv[++i]);
+      if (opts.opus_complexity < 0 || opts.opus_complexity > 10) {
+        throw std::runtime_error(
+            "Invalid opus complexity: " + std::to_string(opts.opus_complexity) +
+            " (0-10 supported)");
+      }
+    } else if (arg == "--opus-frame-size" && i + 1 < argc) {
+      opts.opus_frame_ms = std::stod(argv[++i]);
+      const double sizes[] = {2.5, 5.0, 10.0, 20.0, 40.0, 60.0};
+      if (std::find(std::begin(sizes), std::end(sizes), opts.opus_frame_ms) ==
+          std::end(sizes)) {
+        throw std::runtime_error("Invalid opus frame size: " +
+                                 std::string(argv[i]) +
+                                 " ms (2.5, 5, 10, 20, 40, 60 supported)");
+      }
     } else if (arg == "--vorbis-quality" && i + 1 < argc) {
       opts.vorbis_quality = std::stoi(argv[++i]);
       if (opts.vorbis_quality < 0 || opts.vorbis_quality > 10) {
@@ -460,26 +5166,183 @@ AudioOptions parseArguments(int argc, const char *const argv[],
                                  std::to_string(opts.stereo_separation) +
                                  " (0-200 supported)");
       }
+    } else if (arg == "--encoder-threads" && i + 1 < argc) {
+      opts.encoder_threads = std::stoi(argv[++i]);
+      if (opts.encoder_threads < 0 || opts.encoder_threads > 256) {
+        throw std::runtime_error("Invalid encoder threads: " +
+                                 std::to_string(opts.encoder_threads) +
+                                 " (0-256 supported, 0 = auto)");
+      }
+    } else if (arg == "--flac-level" && i + 1 < argc) {
+      opts.flac_compression_level = std::stoi(argv[++i]);
+      if (opts.flac_compression_level < 0 || opts.flac_compression_level > 8) {
+        throw std::runtime_error("Invalid FLAC compression level: " +
+                                 std::to_string(opts.flac_compression_level) +
+                                 " (0-8 supported)");
+      }
+    } else if (arg == "--flac-seekpoint-spacing" && i + 1 < argc) {
+      opts.flac_seekpoint_spacing = std::stod(argv[++i]);
+      if (opts.flac_seekpoint_spacing < 0.0 ||
+          opts.flac_seekpoint_spacing > 3600.0) {
+        throw std::runtime_error(
+            "Invalid FLAC seek point spacing: " + std::string(argv[i]) +
+            " (0-3600 seconds supported, 0 = no seek table)");
+      }
+    } else if (arg == "--no-flac-md5") {
+      opts.flac_md5 = false;
+    } else if (arg == "--flac-single-encoder") {
+      opts.flac_single_encoder = true;
+    } else if (arg == "--peaks") {
+      opts.peaks = true;
+    } else if (arg == "--peaks-spp" && i + 1 < argc) {
+      opts.peaks_samples_per_pixel = std::stoi(argv[++i]);
+      if (opts.peaks_samples_per_pixel < 2 ||
+          opts.peaks_samples_per_pixel > 1048576) {
+        throw std::runtime_error("Invalid peaks samples per pixel: " +
+                                 std::to_string(opts.peaks_samples_per_pixel) +
+                                 " (2-1048576 supported)");
+      }
+    } else if (arg == "--peaks-levels" && i + 1 < argc) {
+      opts.peaks_levels = std::stoi(argv[++i]);
+      if (opts.peaks_levels < 1 || opts.peaks_levels > 16) {
+        throw std::runtime_error("Invalid peaks zoom levels: " +
+                                 std::to_string(opts.peaks_levels) +
+                                 " (1-16 supported)");
+      }
+    } else if (arg == "--peaks-format" && i + 1 < argc) {
+      opts.peaks_format = argv[++i];
+      if (opts.peaks_format != "dat" && opts.peaks_format != "json") {
+        throw std::runtime_error("Invalid peaks format: " + opts.peaks_format +
+                                 " (dat, json supported)");
+      }
+    } else if (arg == "--split-by" && i + 1 < argc) {
+      opts.split_by = argv[++i];
+      if (opts.split_by != "instrument" && opts.split_by != "channel" &&
+          opts.split_by != "instrument-channel") {
+        throw std::runtime_error("Invalid split mode: " + opts.split_by +
+                                 " (instrument, channel, instrument-channel "
+                                 "supported)");
+      }
+    } else if (arg == "--minus-one") {
+      opts.minus_one = true;
+    } else if (arg == "--no-group-probe") {
+      opts.group_probe = false;
+    } else if (arg == "--info") {
+      opts.info = true;
+    } else if (arg == "--list-instruments") {
+      opts.list_instruments = true;
+    } else if (arg == "--measure-loudness" && i + 1 < argc) {
+      opts.measure_loudness = argv[++i];
     } else if (arg == "--help") {
       std::cout << "Usage: " << argv[0] << " [OPTIONS]\n";
       std::cout << "Options:\n";
+      std::cout << "  -i INPUT                   Input module file, or a directory "
+                   "of modules (required)\n";
+      std::cout << "  -o OUTPUT_DIR              Output directory (required "
+                   "unless only reading metadata)\n";
       std::cout
-          << "  -i INPUT_FILE              Input module file (required)\n";
-      std::cout << "  -o OUTPUT_DIR              Output directory (required)\n";
-      std::cout
-          << "  --sample-rate RATE         Sample rate (default: 44100)\n";
+          << "  --sample-rate RATE[,RATE]  Sample rate(s); several rates are "
+             "rendered once\n"
+             "                             and resampled into per-rate "
+             "subdirectories\n"
+             "                             (default: 44100)\n";
       std::cout
           << "  --channels NUM             Number of channels (default: 2)\n";
       std::cout << "  --resample METHOD          Resampling method: nearest, "
                    "linear, cubic, sinc (default: sinc)\n";
-      std::cout << "  --format FORMAT            Output format: wav, flac, "
-                   "vorbis, opus (default: wav)\n";
+      std::cout << "  --format FORMAT[,FORMAT]   Output format(s): wav, flac, "
+                   "vorbis, opus; several\n"
+                   "                             formats share one render "
+                   "(default: wav)\n";
       std::cout << "  --bit-depth DEPTH          Bit depth for lossless "
                    "formats (16 or 24, default: 16)\n";
+      std::cout << "  --opus-bitrate KBPS        Opus bitrate in kbps (16-512, "
+                   "default: 128)\n";
+      std::cout << "  --opus-bitrate-mode MODE   Opus bitrate mode: vbr, cvbr, "
+                   "cbr (default: vbr)\n";
+      std::cout << "  --opus-complexity LEVEL    Opus encoder complexity (0-10, "
+                   "default: 10)\n";
+      std::cout << "  --opus-frame-size MS       Opus frame size: 2.5, 5, 10, "
+                   "20, 40, 60 (default: 20)\n";
       std::cout << "  --vorbis-quality LEVEL     Vorbis quality level (0-10, "
                    "default: 5)\n";
       std::cout << "  --stereo-separation PERCENT Stereo separation in percent "
                    "(0-200, default: 100)\n";
+      std::cout << "  --encoder-threads NUM      Encoder threads: stems "
+                   "encoded at once, FLAC runs in flight (default: 0 = auto)\n";
+      std::cout << "  --flac-level LEVEL         FLAC compression level "
+                   "(0-8, default: 5)\n";
+      std::cout << "  --flac-seekpoint-spacing SECONDS FLAC seek point "
+                   "interval (default: 10, 0 = none)\n";
+      std::cout << "  --no-flac-md5              Skip the FLAC MD5 signature "
+                   "(faster throwaway renders)\n";
+      std::cout << "  --flac-single-encoder      Encode each FLAC stem with one "
+                   "encoder (reference for the\n"
+                   "                             parallel encode)\n";
+      std::cout << "  --peaks                    Write waveform overview "
+                   "files next to each stem\n";
+      std::cout << "  --peaks-spp SAMPLES        Samples per pixel of the "
+                   "finest zoom level (default: 256)\n";
+      std::cout << "  --peaks-levels NUM         Number of zoom levels, each "
+                   "halving resolution (default: 1)\n";
+      std::cout << "  --peaks-format FORMAT      Peaks file format: dat, json "
+                   "(default: dat)\n";
+      std::cout << "  --split-by MODE            One stem per instrument, "
+                   "channel or instrument-channel\n"
+                   "                             pair used in the patterns "
+                   "(default: instrument)\n";
+      std::cout << "  --minus-one                Also write the full mix "
+                   "without each stem\n";
+      std::cout << "  --no-group-probe           Probe each stem for sound on "
+                   "its own\n";
+      std::cout << "  --jobs NUM                 Render workers, each with its "
+                   "own module copy\n"
+                   "                             (default: 1, 0 = available "
+                   "CPUs)\n";
+      std::cout << "  --prefetch NUM             Batch modules read and parsed "
+                   "ahead of the render\n"
+                   "                             (default: 2, 0 = off)\n";
+      std::cout << "  --no-dedupe                Render byte-identical batch "
+                   "modules again instead of\n"
+                   "                             linking the stems of the "
+                   "first copy\n";
+      std::cout << "  --max-duration SECONDS     Cut the stems off after this "
+                   "much song time (0 = no limit)\n";
+      std::cout << "  --timeout SECONDS          Stop a module still rendering "
+                   "after this wall time\n"
+                   "                             (0 = no limit)\n";
+      std::cout << "  --stem-timeout SECONDS     Stop a stem still rendering "
+                   "after this wall time and\n"
+                   "                             go on with the next "
+                   "(0 = no limit)\n";
+      std::cout << "  --workers-mode MODE        thread, or process: forked "
+                   "workers sharing the parsed\n"
+                   "                             module, isolating crashes "
+                   "(default: thread)\n";
+      std::cout << "  --pin-workers              Pin each render worker to one "
+                   "CPU\n";
+      std::cout << "  --cpu-list LIST            Run all threads on these CPUs, "
+                   "e.g. 0-3,8\n";
+      std::cout << "  --nice LEVEL               Lower the priority of all "
+                   "threads (0-19, default: 0)\n";
+      std::cout << "  --sched-batch              Schedule all threads as CPU-"
+                   "bound batch work (Linux)\n";
+      std::cout << "  --huge-pages               Back render buffers with "
+                   "transparent huge pages\n";
+      std::cout << "  --max-memory SIZE          Memory budget (K, M or G suffix); "
+                   "fewer workers and\n"
+                   "                             shallower encoder queues are "
+                   "used to stay within it\n";
+      std::cout << "  --generic-kernels          Use the generic render and "
+                   "conversion loops (benchmarking)\n";
+      std::cout << "  --info                     Print module metadata as JSON "
+                   "(one line per module),\n"
+                   "                             without rendering\n";
+      std::cout << "  --list-instruments         List instruments and whether "
+                   "the patterns use them\n";
+      std::cout << "  --measure-loudness FILE    Measure an audio file with the "
+                   "stem loudness meter\n"
+                   "                             and print it as JSON\n";
       std::cout << "  --help                     Show this help\n";
       std::cout << "\nSupported input formats: MOD, XM, IT, S3M, and other "
                    "tracker formats supported by libopenmpt\n";
@@ -489,19 +5352,262 @@ AudioOptions parseArguments(int argc, const char *const argv[],
   }
 
   // Set default sample rate to 48000 for opus format if not explicitly set by user
-  if (opts.output_format == "opus" && opts.sample_rate == 44100) {
+  if (opts.output_formats.empty()) {
+    opts.output_formats.push_back(opts.output_format);
+  }
+  if (opts.output_formats.size() == 1 && opts.output_format == "opus" &&
+      opts.sample_rate == 44100 && opts.sample_rates.size() <= 1) {
     opts.sample_rate = 48000;  // Opus default sample rate
+    opts.sample_rates.clear();
+  }
+  if (opts.sample_rates.empty()) {
+    opts.sample_rates.push_back(opts.sample_rate);
+  }
+  if (std::find(opts.output_formats.begin(), opts.output_formats.end(),
+                "opus") != opts.output_formats.end()) {
+    for (size_t i = 0; i < opts.sample_rates.size(); ++i) {
+      if (opusRepeatsRate(opts.sample_rates, i)) {
+        std::cerr << "Warning: Opus at " << opts.sample_rates[i]
+                  << " Hz would be resampled to "
+                  << opusSampleRate(opts.sample_rates[i])
+                  << " Hz, which is already written; skipping it"
+                  << std::endl;
+      }
+    }
   }
 
   return opts;
 }
 
+// Entries of a zip archive that may be modules, as "pack.zip:entry", in
+// archive order so a batch reads the archive front to back. The batch
+// keeps the archive in held, which keeps it parsed until the batch ends.
+std::vector<std::string>
+archiveInputs(const std::string &archive,
+              std::vector<std::shared_ptr<ZipArchive>> &held) {
+  held.push_back(ZipArchive::open(archive));
+  std::vector<std::string> inputs;
+  for (const ZipArchive::Entry &entry : held.back()->entries()) {
+    std::string name = entry.name.substr(entry.name.find_last_of('/') + 1);
+    if (!name.empty() && name.front() != '.') {
+      inputs.push_back(archive + ":" + entry.name);
+    }
+  }
+  return inputs;
+}
+
+// Module files below a batch input directory, in a stable order; zip
+// archives among them stand for their entries
+std::vector<std::string>
+collectInputFiles(const std::string &directory,
+                  std::vector<std::shared_ptr<ZipArchive>> &held) {
+  std::vector<std::string> files;
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator(directory)) {
+    if (entry.is_regular_file() &&
+        entry.path().filename().string().front() != '.') {
+      files.push_back(entry.path().string());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  std::vector<std::string> inputs;
+  for (const std::string &file : files) {
+    if (ZipArchive::is_archive(file)) {
+      std::vector<std::string> entries = archiveInputs(file, held);
+      inputs.insert(inputs.end(), entries.begin(), entries.end());
+    } else {
+      inputs.push_back(file);
+    }
+  }
+  return inputs;
+}
+
+// Modules of a batch rendered so far, by content, so byte-identical copies
+// under other names reuse their stems instead of rendering again
+class DuplicateIndex {
+public:
+  struct Rendered {
+    std::string path;
+    std::string output_dir;
+    size_t size = 0;
+  };
+
+  // The first rendered copy of this module, or nullptr. Hash matches are
+  // confirmed against the first copy as it is read back, so no copy is
+  // held in memory beyond the module being loaded.
+  const Rendered *find(const LoadedModule &module) const {
+    auto range = rendered.equal_range(module.content_hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      const Rendered &first = it->second;
+      if (first.size != module.file_data.size()) {
+        continue;
+      }
+      try {
+        if (same_content(first.path, module.file_data)) {
+          return &first;
+        }
+      } catch (const std::exception &) {
+        // The first copy is gone; this one renders
+      }
+    }
+    return nullptr;
+  }
+
+  void add(uint64_t hash, size_t size, const std::string &path,
+           const std::string &output_dir) {
+    rendered.emplace(hash, Rendered{path, output_dir, size});
+  }
+
+private:
+  std::multimap<uint64_t, Rendered> rendered;
+
+  // Whether the input at path holds these bytes. Plain files are compared
+  // chunk by chunk as they are read; archive entries and gzip files have
+  // to be unpacked, so they are read whole and dropped after the compare.
+  static bool same_content(const std::string &path,
+                           const std::vector<char> &data) {
+    std::string archive, entry;
+    if (path == "-") {
+      return false; // standard input cannot be read again
+    }
+    if (!splitArchiveEntry(path, archive, entry)) {
+      std::ifstream file(path, std::ios::binary);
+      if (!file.is_open()) {
+        return false;
+      }
+      std::vector<char> chunk(64 * 1024);
+      size_t offset = 0;
+      while (file) {
+        file.read(chunk.data(), chunk.size());
+        size_t count = static_cast<size_t>(file.gcount());
+        if (offset == 0 && count >= 2 && isGzip(chunk)) {
+          return readInputFile(path) == data;
+        }
+        if (count > data.size() - offset ||
+            !std::equal(chunk.begin(), chunk.begin() + count,
+                        data.begin() + offset)) {
+          return false;
+        }
+        offset += count;
+      }
+      return offset == data.size();
+    }
+    return readInputFile(path) == data;
+  }
+};
+
+// Gives a duplicate module the output of its first copy: every stem is
+// hardlinked, or copied where links are not possible, and report.json is
+// rewritten under the duplicate's name. Returns the number of files.
+int linkDuplicateOutput(const DuplicateIndex::Rendered &first,
+                        const std::string &module_name,
+                        const std::string &output_dir) {
+  // Copies with the same file name in other directories share one
+  // output directory, which already holds the stems
+  if (std::filesystem::weakly_canonical(first.output_dir) ==
+      std::filesystem::weakly_canonical(output_dir)) {
+    return 0;
+  }
+  int files = 0;
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator(first.output_dir)) {
+    std::filesystem::path relative =
+        entry.path().lexically_relative(first.output_dir);
+    std::filesystem::path target = std::filesystem::path(output_dir) / relative;
+    if (entry.is_directory()) {
+      std::filesystem::create_directories(target);
+      continue;
+    }
+    if (relative == "report.json") {
+      continue;
+    }
+    std::filesystem::create_directories(target.parent_path());
+    std::filesystem::remove(target);
+    std::error_code error;
+    std::filesystem::create_hard_link(entry.path(), target, error);
+    if (error) {
+      std::filesystem::copy_file(entry.path(), target);
+    }
+    files++;
+  }
+
+  // The report is the first copy's with the module name swapped
+  std::ifstream in(first.output_dir + "/report.json");
+  std::string report((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+  std::string first_name = "\"module\": " + jsonString(moduleName(first.path));
+  size_t at = report.find(first_name);
+  if (at != std::string::npos) {
+    report.replace(at, first_name.size(),
+                   "\"module\": " + jsonString(module_name) +
+                       ",\n  \"duplicate_of\": " + jsonString(first.path));
+  }
+  std::ofstream out(output_dir + "/report.json");
+  out << report;
+  if (!out) {
+    throw std::runtime_error("Could not write report: " + output_dir +
+                             "/report.json");
+  }
+  return files;
+}
+
+// Runs an audio file libsndfile can read through the meter the stems are
+// measured with, and prints the result as one JSON line
+void measureLoudness(const std::string &path) {
+  SF_INFO info = {};
+  SNDFILE *file = sf_open(path.c_str(), SFM_READ, &info);
+  if (!file) {
+    throw std::runtime_error("Could not open " + path + ": " +
+                             sf_strerror(nullptr));
+  }
+  constexpr size_t BLOCK_FRAMES = 65536;
+  LoudnessMeter meter(info.samplerate, info.channels);
+  PlanarBlock block(info.channels, BLOCK_FRAMES);
+  std::vector<float> interleaved(BLOCK_FRAMES * info.channels);
+  auto start = std::chrono::steady_clock::now();
+  while (true) {
+    sf_count_t frames = sf_readf_float(file, interleaved.data(), BLOCK_FRAMES);
+    if (frames <= 0) {
+      break;
+    }
+    for (int c = 0; c < info.channels; ++c) {
+      float *out = block.channel(c);
+      for (sf_count_t i = 0; i < frames; ++i) {
+        out[i] = interleaved[i * info.channels + c];
+      }
+    }
+    meter.process(block, static_cast<int>(frames));
+  }
+  sf_close(file);
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cout << "{\"file\": " << jsonString(path)
+            << ", \"channels\": " << info.channels
+            << ", \"sample_rate\": " << info.samplerate
+            << ", \"frames\": " << meter.frames()
+            << ", \"integrated_lufs\": " << jsonNumber(meter.integrated_lufs())
+            << ", \"true_peak_dbtp\": " << jsonNumber(meter.true_peak_dbtp())
+            << ", \"sample_peak_dbfs\": "
+            << jsonNumber(meter.sample_peak_dbfs())
+            << ", \"seconds\": " << seconds << "}" << std::endl;
+}
+
+// Exit status when a module was stopped at --timeout
+constexpr int EXIT_RENDER_LIMIT = 3;
+
 int main(int argc, char *argv[]) {
   try {
     std::string input_file, output_dir;
     AudioOptions opts = parseArguments(argc, argv, input_file, output_dir);
+    bool metadata_only = opts.info || opts.list_instruments;
+
+    if (!opts.measure_loudness.empty()) {
+      measureLoudness(opts.measure_loudness);
+      return 0;
+    }
 
-    if (input_file.empty() || output_dir.empty()) {
+    if (input_file.empty() || (output_dir.empty() && !metadata_only)) {
       std::cerr << "Usage: " << argv[0]
                 << " -i <input_module_file> -o <output_directory> [OPTIONS]"
                 << std::endl;
@@ -509,9 +5615,118 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
-    StemExtractor extractor(input_file, opts);
-    extractor.extractStems(output_dir);
-    std::cout << "Stem extraction completed successfully!" << std::endl;
+    applySchedulingOptions(opts);
+
+    // A directory or zip archive is processed as a batch, where a module
+    // that fails is reported and the batch goes on
+    bool batch = std::filesystem::is_directory(input_file) ||
+                 ZipArchive::is_archive(input_file);
+    std::vector<std::shared_ptr<ZipArchive>> archives; // open for the batch
+    std::vector<std::string> inputs =
+        !batch ? std::vector<std::string>{input_file}
+        : std::filesystem::is_directory(input_file)
+            ? collectInputFiles(input_file, archives)
+            : archiveInputs(input_file, archives);
+    int failed = 0;
+    int stopped = 0;
+    int truncated = 0;  // cut off at --max-duration
+    int skipped = 0;    // not modules
+    int duplicates = 0; // linked to an earlier copy
+    DuplicateIndex rendered;
+    // The next modules of a batch load while the current one renders
+    std::unique_ptr<ModulePrefetcher> prefetcher;
+    if (batch && !metadata_only && opts.prefetch > 0) {
+      prefetcher = std::make_unique<ModulePrefetcher>(inputs, opts.prefetch,
+                                                      opts.max_memory);
+    }
+    for (const std::string &path : inputs) {
+      try {
+        if (metadata_only) {
+          ModuleInfo info(path);
+          std::cout << (opts.info ? info.json() + "\n" : info.listing());
+        } else {
+          LoadedModule loaded =
+              prefetcher ? prefetcher->next() : loadModule(path, true);
+          uint64_t hash = loaded.content_hash;
+          size_t size = loaded.file_data.size();
+          const DuplicateIndex::Rendered *first =
+              batch && opts.dedupe ? rendered.find(loaded) : nullptr;
+          if (first) {
+            std::string module_dir =
+                StemExtractor::module_dir(output_dir, path);
+            try {
+              int files =
+                  linkDuplicateOutput(*first, moduleName(path), module_dir);
+              std::cout << "Duplicate of " << first->path << ": linked "
+                        << files << " files to " << module_dir << std::endl;
+              duplicates++;
+              continue;
+            } catch (const std::exception &e) {
+              // Whatever was linked goes, so the render cannot write
+              // through a link into the first copy's stems
+              std::cerr << "Could not link " << path << " to "
+                        << first->path << ": " << e.what()
+                        << "; rendering it" << std::endl;
+              std::filesystem::remove_all(module_dir);
+            }
+          }
+          StemExtractor extractor(std::move(loaded), opts);
+          extractor.set_prefetcher(prefetcher.get());
+          bool finished = extractor.extractStems(output_dir);
+          if (extractor.truncated()) {
+            truncated++;
+          }
+          if (!finished) {
+            stopped++;
+          } else if (batch && opts.dedupe) {
+            rendered.add(hash, size, path,
+                         StemExtractor::module_dir(output_dir, path));
+          }
+        }
+      } catch (const NotAModuleError &) {
+        // Files a mixed directory holds besides modules are not failures
+        if (!batch) {
+          throw;
+        }
+        std::cerr << "Skipping " << path << ": not a module" << std::endl;
+        skipped++;
+      } catch (const std::exception &e) {
+        if (!batch) {
+          throw;
+        }
+        std::cerr << "Error: " << path << ": " << e.what() << std::endl;
+        failed++;
+      }
+    }
+
+    if (batch) {
+      // Metadata goes to stdout, so the batch totals go to stderr
+      std::ostream &out = metadata_only ? std::cerr : std::cout;
+      out << "Batch summary: " << inputs.size() - skipped << " modules, "
+          << failed << " failed";
+      if (skipped > 0) {
+        out << ", " << skipped << " skipped as not modules";
+      }
+      if (duplicates > 0) {
+        out << ", " << duplicates << " duplicates linked";
+      }
+      if (truncated > 0) {
+        out << ", " << truncated << " truncated at --max-duration";
+      }
+      if (stopped > 0) {
+        out << ", " << stopped << " stopped at a render limit";
+      }
+      out << std::endl;
+    }
+    if (failed > 0) {
+      return 1;
+    }
+    if (stopped > 0) {
+      return EXIT_RENDER_LIMIT;
+    }
+    if (!metadata_only) {
+      std::cout << "Stem extraction completed successfully!" << std::endl;
+    }
   } catch (const std::exception &e) {
     std::cerr << "Error: " << e.what() << std::endl;
     return 1;